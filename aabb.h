@@ -0,0 +1,119 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <cfloat>
+#include <algorithm>
+#include "ray.h"
+
+inline float ffmin(float a, float b) { return a < b ? a : b; }
+inline float ffmax(float a, float b) { return a > b ? a : b; }
+
+// Axis aligned bounding box
+class aabb
+{
+ public:
+  aabb() { _min = vec3(FLT_MAX, FLT_MAX, FLT_MAX); _max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX); }
+ aabb(const vec3& a, const vec3& b) : _min(a), _max(b) {}
+
+  vec3 min() const { return _min; }
+  vec3 max() const { return _max; }
+  vec3 centroid() const { return 0.5f*(_min + _max); }
+  bool empty() const { return _min.x() > _max.x(); }
+
+  inline bool hit(const ray& r, float tmin, float tmax) const;
+  inline bool hit(const vec3& origin, const vec3& inv_dir, float tmin, float tmax) const;
+  inline float surface_area() const;
+  inline int longest_axis() const;
+  inline void expand(const vec3& p);
+  inline void expand(const aabb& box);
+
+  vec3 _min;
+  vec3 _max;
+};
+
+// Slab test from Kay and Kajiya, using a precomputed reciprocal direction
+inline bool aabb::hit(const vec3& origin, const vec3& inv_dir, float tmin, float tmax) const
+{
+  for (int a = 0; a < 3; ++a)
+    {
+      float t0 = (_min[a] - origin[a]) * inv_dir[a];
+      float t1 = (_max[a] - origin[a]) * inv_dir[a];
+      if (inv_dir[a] < 0.0f)
+	std::swap(t0, t1);
+      tmin = ffmax(t0, tmin);
+      tmax = ffmin(t1, tmax);
+      if (tmax < tmin)
+	return false;
+    }
+  return true;
+}
+
+// Same test against the box a fraction s of the way from box0 to box1, without building it
+inline bool hit_interpolated(const aabb& box0, const aabb& box1, float s, const vec3& origin, const vec3& inv_dir, float tmin, float tmax)
+{
+  for (int a = 0; a < 3; ++a)
+    {
+      float lo = box0._min[a] + s*(box1._min[a] - box0._min[a]);
+      float hi = box0._max[a] + s*(box1._max[a] - box0._max[a]);
+      float t0 = (lo - origin[a]) * inv_dir[a];
+      float t1 = (hi - origin[a]) * inv_dir[a];
+      if (inv_dir[a] < 0.0f)
+	std::swap(t0, t1);
+      tmin = ffmax(t0, tmin);
+      tmax = ffmin(t1, tmax);
+      if (tmax < tmin)
+	return false;
+    }
+  return true;
+}
+
+inline bool aabb::hit(const ray& r, float tmin, float tmax) const
+{
+  vec3 d = r.direction();
+  return hit(r.origin(), vec3(1.0f / d.x(), 1.0f / d.y(), 1.0f / d.z()), tmin, tmax);
+}
+
+inline float aabb::surface_area() const
+{
+  if (empty())
+    return 0.0f;
+  vec3 d = _max - _min;
+  return 2.0f * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+}
+
+inline int aabb::longest_axis() const
+{
+  vec3 d = _max - _min;
+  if (d.x() > d.y() && d.x() > d.z())
+    return 0;
+  return (d.y() > d.z()) ? 1 : 2;
+}
+
+inline void aabb::expand(const vec3& p)
+{
+  _min = vec3(ffmin(_min.x(), p.x()), ffmin(_min.y(), p.y()), ffmin(_min.z(), p.z()));
+  _max = vec3(ffmax(_max.x(), p.x()), ffmax(_max.y(), p.y()), ffmax(_max.z(), p.z()));
+}
+
+inline void aabb::expand(const aabb& box)
+{
+  expand(box._min);
+  expand(box._max);
+}
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1)
+{
+  aabb box = box0;
+  box.expand(box1);
+  return box;
+}
+
+inline bool same_box(const aabb& a, const aabb& b)
+{
+  for (int i = 0; i < 3; ++i)
+    if (a._min[i] != b._min[i] || a._max[i] != b._max[i])
+      return false;
+  return true;
+}
+
+#endif
@@ -1,120 +1,465 @@
 #pragma once
 #include "sphere.h"
+#include "sphere_set.h"
 #include "plane.h"
 #include "triangle.h"
 #include "moving_sphere.h"
+#include "moving_triangle.h"
+#include "quad.h"
+#include "primitives.h"
+#include "mesh.h"
+#include "obj_loader.h"
+#include "scene_file.h"
 
 #include "hitable_list.h"
+#include "bvh.h"
+#include "instance.h"
 #include "material.h"
+#include "scene.h"
 
-extern vec3 LOOKFROM;
-extern vec3 LOOKAT;
-
-hitable *cornell_box_test()
+// Render with --mode global, the box is lit only by the quad light in the ceiling
+scene cornell_box_test()
 {
-    int n = 9; 
-    hitable **list = new hitable*[n + 1];
-    list[0] = new sphere(vec3(1e5f + 1.0f, 40.8f, 81.6f), 1e5f, new lambertian(new constant_texture(vec3(0.85f, 0.35f, 0.35f))));
-    list[1] = new sphere(vec3(-1e5f + 99.0f, 40.8f, 81.6f), 1e5f, new lambertian(new constant_texture(vec3(0.35f, 0.35f, 0.85f))));
-    list[2] = new sphere(vec3(50.0f, 40.8f, 1e5f), 1e5f, new lambertian(new constant_texture(vec3(0.75f, 0.75f, 0.75f))));
-    list[3] = new sphere(vec3(50.0f, 40.8f, -1e5f + 600.0f), 1e5f, new lambertian(new constant_texture(vec3(1.0f, 1.0f, 1.0f))));
-    list[4] = new sphere(vec3(50.0f, 1e5f, 81.6f), 1e5f, new lambertian(new constant_texture(vec3(0.75f, 0.75f, 0.75f))));
-    list[5] = new sphere(vec3(50.0f, -1e5f + 81.6f, 81.6f), 1e5f, new lambertian(new constant_texture(vec3(0.75f, 0.75f, 0.75f))));
-    list[6] = new sphere(vec3(27.0f, 16.5f, 47.0f), 16.5f, new lambertian(new constant_texture(vec3(0.9f, 0.1f, 0.1f))));
-    list[7] = new sphere(vec3(73.0f, 16.5f, 78.0f), 16.5f, new lambertian(new constant_texture(vec3(0.1f, 0.3f, 1.0f))));
-    list[8] = new sphere(vec3(50.0f, 681.6f - .77f, 81.6f), 600.0f, new lambertian(new constant_texture(vec3(0.0f, 0.0f, 0.0f))));
+    scene s;
+    arena& a = *s.objects;
+    // The walls used to be spheres of radius 1e5, which are too imprecise in float for rays
+    // leaving them to reliably miss the wall they start on
+    int n = 9;
+    hitable **list = a.make_array<hitable*>(n + 1);
+    const float w = 98.0f, h = 81.6f, d = 600.0f;
+    list[0] = a.make<quad>(vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, h, 0.0f), vec3(0.0f, 0.0f, d), a.make<diffuse>(a.make<constant_texture>(vec3(0.85f, 0.35f, 0.35f))));  // left
+    list[1] = a.make<quad>(vec3(99.0f, 0.0f, 0.0f), vec3(0.0f, h, 0.0f), vec3(0.0f, 0.0f, d), a.make<diffuse>(a.make<constant_texture>(vec3(0.35f, 0.35f, 0.85f))));  // right
+    list[2] = a.make<quad>(vec3(1.0f, 0.0f, 0.0f), vec3(w, 0.0f, 0.0f), vec3(0.0f, h, 0.0f), a.make<diffuse>(a.make<constant_texture>(vec3(0.75f, 0.75f, 0.75f))));  // back
+    list[3] = a.make<quad>(vec3(1.0f, 0.0f, d), vec3(w, 0.0f, 0.0f), vec3(0.0f, h, 0.0f), a.make<diffuse>(a.make<constant_texture>(vec3(1.0f, 1.0f, 1.0f))));  // front
+    list[4] = a.make<quad>(vec3(1.0f, 0.0f, 0.0f), vec3(w, 0.0f, 0.0f), vec3(0.0f, 0.0f, d), a.make<diffuse>(a.make<constant_texture>(vec3(0.75f, 0.75f, 0.75f))));  // floor
+    list[5] = a.make<quad>(vec3(1.0f, h, 0.0f), vec3(w, 0.0f, 0.0f), vec3(0.0f, 0.0f, d), a.make<diffuse>(a.make<constant_texture>(vec3(0.75f, 0.75f, 0.75f))));  // ceiling
+    list[6] = a.make<sphere>(vec3(27.0f, 16.5f, 47.0f), 16.5f, a.make<diffuse>(a.make<constant_texture>(vec3(0.9f, 0.1f, 0.1f))));
+    list[7] = a.make<sphere>(vec3(73.0f, 16.5f, 78.0f), 16.5f, a.make<diffuse>(a.make<constant_texture>(vec3(0.1f, 0.3f, 1.0f))));
+    // Just below the ceiling, facing down
+    list[8] = a.make<quad>(vec3(35.0f, 81.5f, 66.6f), vec3(30.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 30.0f), a.make<emissive>(vec3(30.0f, 30.0f, 30.0f)));
+    s.world = a.make<bvh>(list, n, 0.0f, 1.0f);
+    s.lights.push_back(list[8]);
+    return s;
 }
 
+// A sphere light and a quad light over a diffuse floor, render with --mode global
+scene area_light_test()
+{
+    scene s;
+    arena& a = *s.objects;
+    int n = 5;
+    hitable **list = a.make_array<hitable*>(n);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<diffuse>(checker));
+    list[1] = a.make<sphere>(vec3(0.0f, 1.0f, 0.0f), 1.0f, a.make<diffuse>(a.make<constant_texture>(vec3(0.8f, 0.6f, 0.3f))));
+    list[2] = a.make<sphere>(vec3(-1.5f, 0.5f, 2.0f), 0.5f, a.make<metal>(vec3(0.9f, 0.9f, 0.9f), 0.05f));
+    list[3] = a.make<sphere>(vec3(2.0f, 2.5f, -1.0f), 0.4f, a.make<emissive>(vec3(20.0f, 16.0f, 12.0f)));
+    list[4] = a.make<quad>(vec3(-3.0f, 4.0f, -1.0f), vec3(2.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 2.0f), a.make<emissive>(vec3(4.0f, 6.0f, 10.0f)));
+    s.world = a.make<bvh>(list, n, 0.0f, 1.0f);
+    s.lights.push_back(list[3]);
+    s.lights.push_back(list[4]);
+    s.sky = false;
+    s.lookfrom = vec3(8.0f, 3.0f, 8.0f);
+    s.lookat = vec3(0.0f, 0.8f, 0.0f);
+    return s;
+}
 
-hitable *reflect_diffuse_test()
+scene reflect_diffuse_test()
 {
+    scene s;
+    arena& a = *s.objects;
     int n = 2;
-    hitable **list = new hitable*[n + 1];
-    texture *checker = new checker_texture(new constant_texture(vec3(0.3, 0.3, 0.3)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-    //list[0] = new sphere(vec3(0.0f, 0.5f, 0.0f), 0.5, new metal(vec3(1.0f, 0.2f, 0.2f), 0.0f, 0.0f));   // all diffuse
-    //list[0] = new sphere(vec3(0.0f, 0.5f, 0.0f), 0.5, new metal(vec3(1.0f, 0.2f, 0.2f), 0.0f, 0.02f));  // 2% reflectance
-    //list[0] = new sphere(vec3(0.0f, 0.5f, 0.0f), 0.5, new metal(vec3(1.0f, 0.2f, 0.2f), 0.0f, 0.5f));    // 50% reflectance
-    list[0] = new sphere(vec3(0.0f, 0.5f, 0.0f), 0.5, new metal(vec3(1.0f, 0.2f, 0.2f), 0.0f, 1.0f));    // all reflectance  
-    list[1] = new sphere(vec3(0, -1000, 0), 1000.0f, new lambertian(checker));
-    return new hitable_list(list, 2);
+    hitable **list = a.make_array<hitable*>(n + 1);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    //list[0] = a.make<sphere>(vec3(0.0f, 0.5f, 0.0f), 0.5, a.make<metal>(vec3(1.0f, 0.2f, 0.2f), 0.0f, 0.0f));   // all diffuse
+    //list[0] = a.make<sphere>(vec3(0.0f, 0.5f, 0.0f), 0.5, a.make<metal>(vec3(1.0f, 0.2f, 0.2f), 0.0f, 0.02f));  // 2% reflectance
+    //list[0] = a.make<sphere>(vec3(0.0f, 0.5f, 0.0f), 0.5, a.make<metal>(vec3(1.0f, 0.2f, 0.2f), 0.0f, 0.5f));    // 50% reflectance
+    list[0] = a.make<sphere>(vec3(0.0f, 0.5f, 0.0f), 0.5, a.make<metal>(vec3(1.0f, 0.2f, 0.2f), 0.0f, 1.0f));    // all reflectance  
+    list[1] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<lambertian>(checker));
+    s.world = a.make<bvh>(list, 2, 0.0f, 1.0f);
+    return s;
 }
 
-hitable *fresnel_test()
+scene fresnel_test()
 {
+    scene s;
+    arena& a = *s.objects;
     int n = 4;
-    hitable **list = new hitable*[n + 1];
-    texture *checker = new checker_texture(new constant_texture(vec3(0.3, 0.3, 0.3)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-    list[0] = new sphere(vec3(0, 0.5, 0), 0.5, new dielectric(vec3(0.8f, 0.2f, 0.2f), 1.125f));
-    list[1] = new sphere(vec3(0, -1000, 0), 1000.0f, new lambertian(checker));
-    return new hitable_list(list, 2);
+    hitable **list = a.make_array<hitable*>(n + 1);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = a.make<sphere>(vec3(0, 0.5, 0), 0.5, a.make<dielectric>(vec3(0.8f, 0.2f, 0.2f), 1.125f));
+    list[1] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<lambertian>(checker));
+    s.world = a.make<bvh>(list, 2, 0.0f, 1.0f);
+    return s;
 }
 
-hitable *beer_test()
+scene beer_test()
 {
-    LOOKFROM = vec3(5.0f, 3.5f, 3.0f);
-    LOOKAT = vec3(0.0f, 0.0f, 0.0f);
-
+    scene s;
+    arena& a = *s.objects;
     int n = 4;
-    hitable **list = new hitable*[n + 1];
-    texture *checker = new checker_texture(new constant_texture(vec3(0.3, 0.3, 0.3)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-    list[0] = new sphere(vec3(0, -1000, 0), 1000.0f, new lambertian(checker));
-    //list[1] = new sphere(vec3(0.0, 0.5, 0.5), 0.5, new dielectric(vec3(1.0f, 1.0f, 1.0f), 1.125f, vec3(18.0f, 18.0f, 0.3f)));  // with red, green absorption
-    //list[2] = new sphere(vec3(0.0, 0.5, 0), 0.5, new dielectric(vec3(1.0f, 1.0f, 1.0f), 1.5f, vec3(0.3f, 5.0f, 9.0f)));  // with blue, green absorption
-    //list[2] = new sphere(vec3(-2.0, 0.8, 0), 0.8, new dielectric(vec3(1.0f, 1.0f, 1.0f), 1.5f, vec3(0.5f, 0.5f, 0.5f)));    // without absorption
+    hitable **list = a.make_array<hitable*>(n + 1);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<lambertian>(checker));
+    //list[1] = a.make<sphere>(vec3(0.0, 0.5, 0.5), 0.5, a.make<dielectric>(vec3(1.0f, 1.0f, 1.0f), 1.125f, vec3(18.0f, 18.0f, 0.3f)));  // with red, green absorption
+    //list[2] = a.make<sphere>(vec3(0.0, 0.5, 0), 0.5, a.make<dielectric>(vec3(1.0f, 1.0f, 1.0f), 1.5f, vec3(0.3f, 5.0f, 9.0f)));  // with blue, green absorption
+    //list[2] = a.make<sphere>(vec3(-2.0, 0.8, 0), 0.8, a.make<dielectric>(vec3(1.0f, 1.0f, 1.0f), 1.5f, vec3(0.5f, 0.5f, 0.5f)));    // without absorption
 
-    return new hitable_list(list, 1);
+    s.world = a.make<bvh>(list, 1, 0.0f, 1.0f);
+    s.lookfrom = vec3(5.0f, 3.5f, 3.0f);
+    s.lookat = vec3(0.0f, 0.0f, 0.0f);
+    return s;
 }
 
-hitable *soft_shadow_test()
+scene soft_shadow_test()
 {
-    //vec3 LOOKFROM(5.0f, 3.5f, 3.0f);
-    //vec3 LOOKAT(0.0f, 0.0f, 0.0f);
+    scene s;
+    arena& a = *s.objects;
     int n = 2;
-    hitable **list = new hitable*[n + 1];
-    texture *checker = new checker_texture(new constant_texture(vec3(0.3, 0.3, 0.3)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-    list[0] = new sphere(vec3(0, -1000, 0), 1000.0f, new lambertian(checker));
-    //list[1] = new sphere(vec3(0.0, 0.5, 0), 0.5, new dielectric(vec3(1.0f, 1.0f, 1.0f), 1.125f, vec3(18.0f, 18.0f, 0.3f)));  // with red, green absorption
-    list[1] = new sphere(vec3(0.0, 0.5, 0), 0.5, new lambertian(new constant_texture(vec3(0.9, 0.8, 0.9))));
-    return new hitable_list(list, 2);
+    hitable **list = a.make_array<hitable*>(n + 1);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<lambertian>(checker));
+    //list[1] = a.make<sphere>(vec3(0.0, 0.5, 0), 0.5, a.make<dielectric>(vec3(1.0f, 1.0f, 1.0f), 1.125f, vec3(18.0f, 18.0f, 0.3f)));  // with red, green absorption
+    list[1] = a.make<sphere>(vec3(0.0, 0.5, 0), 0.5, a.make<lambertian>(a.make<constant_texture>(vec3(0.9, 0.8, 0.9))));
+    s.world = a.make<bvh>(list, 2, 0.0f, 1.0f);
+    return s;
 }
 
-hitable *pyramid_test()
+scene pyramid_test()
 {
+    scene s;
+    arena& a = *s.objects;
     int n = 5;
-    hitable **list = new hitable*[n + 1];
-    texture *checker = new checker_texture(new constant_texture(vec3(0.3, 0.3, 0.3)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-    list[0] = new sphere(vec3(0, -1000, 0), 1000.0f, new lambertian(checker));
-    //list[0] = new sphere(vec3(0, -1000, 0), 1000.0f, new metal(vec3(0.5f, 0.5f, 0.5f), 0.0f));
+    hitable **list = a.make_array<hitable*>(n + 1);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<lambertian>(checker));
+    //list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<metal>(vec3(0.5f, 0.5f, 0.5f), 0.0f));
     // Lambertian
 
     // back
-    list[1] = new triangle(
+    list[1] = a.make<triangle>(
             vec3(0.0f, 0.5, 0.0f), // v0 
             vec3(-0.5f, 0.0f, -0.5f),// v1
             vec3(+0.5f, 0.0f, -0.5f), // v2
-            new lambertian(new constant_texture(vec3(0.5f, 0.5f, 1.0f))));
-    //new metal(vec3(1.0f, 0.2f, 0.2f), 0.0f));
+            a.make<lambertian>(a.make<constant_texture>(vec3(0.5f, 0.5f, 1.0f))));
+    //a.make<metal>(vec3(1.0f, 0.2f, 0.2f), 0.0f));
     // TODO
     // right
-    list[2] = new triangle(
+    list[2] = a.make<triangle>(
             vec3(0.0f, 0.5, 0.0f), // v0 
             vec3(0.5f, 0.0f, -0.5f),// v1
             vec3(0.5f, 0.0f, 0.5f), // v2
-            new lambertian(new constant_texture(vec3(0.2f, 1.0f, 0.2f))));
+            a.make<lambertian>(a.make<constant_texture>(vec3(0.2f, 1.0f, 0.2f))));
 
     // front
-    list[3] = new triangle(
+    list[3] = a.make<triangle>(
             vec3(0.0f, 0.5, 0.0f), // v0 
             vec3(0.5f, 0.0f, 0.5f),// v1
             vec3(-0.5f, 0.0f, 0.5f), // v2
-            new lambertian(new constant_texture(vec3(0.5f, 1.0f, 1.0f))));
+            a.make<lambertian>(a.make<constant_texture>(vec3(0.5f, 1.0f, 1.0f))));
 
     // left
-    list[4] = new triangle(
+    list[4] = a.make<triangle>(
             vec3(0.0f, 0.5, 0.0f), // v0 
             vec3(-0.5f, 0.0f, -0.5f),// v1
             vec3(-0.5f, 0.0f, +0.5f), // v2
-            new lambertian(new constant_texture(vec3(1.0f, 0.5f, 1.0f))));
+            a.make<lambertian>(a.make<constant_texture>(vec3(1.0f, 0.5f, 1.0f))));
+
+    s.world = a.make<bvh>(list, 5, 0.0f, 1.0f);
+    return s;
+}
+
+
+// Marble sphere on a ground of plain noise, both from the same tables seeded by --seed
+scene perlin_test()
+{
+    scene s;
+    arena& a = *s.objects;
+    int n = 2;
+    hitable **list = a.make_array<hitable*>(n);
+    perlin *noise = a.make<perlin>(RENDER_SEED);
+    list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<diffuse>(a.make<noise_texture>(noise, 4.0f)));
+    list[1] = a.make<sphere>(vec3(0.0f, 2.0f, 0.0f), 2.0f, a.make<diffuse>(a.make<marble_texture>(noise, 4.0f, vec3(0.9f, 0.85f, 0.8f))));
+    s.world = a.make<bvh>(list, n, 0.0f, 1.0f);
+    s.lookfrom = vec3(20.0f, 4.0f, 5.0f);
+    s.lookat = vec3(0.0f, 1.5f, 0.0f);
+    s.light_pos = vec3(10.0f, 10.0f, 10.0f);
+    return s;
+}
+
+// Cell borders on the sphere and Manhattan spots on the ground, from one generator seeded by --seed
+scene worley_test()
+{
+    scene s;
+    arena& a = *s.objects;
+    int n = 2;
+    hitable **list = a.make_array<hitable*>(n);
+    worley *cells = a.make<worley>(RENDER_SEED);
+    list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<diffuse>(a.make<worley_texture>(cells, 2.0f, WORLEY_F1, WORLEY_MANHATTAN, vec3(0.8f, 0.8f, 0.8f))));
+    list[1] = a.make<sphere>(vec3(0.0f, 2.0f, 0.0f), 2.0f, a.make<diffuse>(a.make<worley_texture>(cells, 3.0f, WORLEY_BORDER, WORLEY_EUCLIDEAN, vec3(0.9f, 0.6f, 0.3f))));
+    s.world = a.make<bvh>(list, n, 0.0f, 1.0f);
+    s.lookfrom = vec3(20.0f, 4.0f, 5.0f);
+    s.lookat = vec3(0.0f, 1.5f, 0.0f);
+    s.light_pos = vec3(10.0f, 10.0f, 10.0f);
+    return s;
+}
+
+// Large field of small random spheres, used to check that the BVH scales
+scene many_spheres_test()
+{
+    scene s;
+    arena& a = *s.objects;
+    int n = 50000;
+    // The spheres only carry the particles into make_sphere_sets, just the sets are kept
+    std::vector<sphere> particles(n);
+    std::vector<sphere*> pointers(n);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    rng gen(RENDER_SEED);
+    for (int i = 1; i < n; ++i)
+    {
+        float x = gen.next_float(), y = gen.next_float(), z = gen.next_float();
+        vec3 center(20.0f*(x - 0.5f), 0.05f + 2.0f*y, 20.0f*(z - 0.5f));
+        float r = gen.next_float(), g = gen.next_float(), b = gen.next_float();
+        vec3 col(r, g, b);
+        if (i % 4 == 0)
+            particles[i] = sphere(center, 0.05f, a.make<metal>(col, 0.1f));
+        else
+            particles[i] = sphere(center, 0.05f, a.make<lambertian>(a.make<constant_texture>(col)));
+        pointers[i] = &particles[i];
+    }
+
+    // The small spheres are packed into SIMD sphere sets, which become the bvh leaves
+    std::vector<hitable*> list;
+    list.push_back(a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<lambertian>(checker)));
+    make_sphere_sets(&pointers[1], n - 1, list, a);
+    s.world = a.make<bvh>(&list[0], (int)list.size(), 0.0f, 1.0f);
+    return s;
+}
+
+// Fast moving spheres and tumbling triangles, each travelling many times its size while the shutter is open
+scene motion_blur_test()
+{
+    scene s;
+    arena& a = *s.objects;
+    int spheres = 3000, triangles = 3000;
+    int n = 1 + spheres + triangles;
+    hitable **list = a.make_array<hitable*>(n);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = a.make<sphere>(vec3(0, -1000, 0), 1000.0f, a.make<lambertian>(checker));
+    rng gen(RENDER_SEED);
+    for (int i = 1; i < n; ++i)
+    {
+        vec3 p(8.0f*(gen.next_float() - 0.5f), 0.2f + 3.0f*gen.next_float(), 8.0f*(gen.next_float() - 0.5f));
+        vec3 velocity(2.0f*(gen.next_float() - 0.5f), 2.0f*(gen.next_float() - 0.5f), 2.0f*(gen.next_float() - 0.5f));
+        material *mat = a.make<lambertian>(a.make<constant_texture>(vec3(gen.next_float(), gen.next_float(), gen.next_float())));
+        if (i <= spheres)
+        {
+            list[i] = a.make<moving_sphere>(p, p + velocity, 0.0f, 1.0f, 0.08f, mat);
+            continue;
+        }
+        // Each corner gets its own velocity, so the triangles stretch and turn as they fly
+        vec3 start[3], end[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            start[k] = p + 0.15f*vec3(gen.next_float() - 0.5f, gen.next_float() - 0.5f, gen.next_float() - 0.5f);
+            end[k] = start[k] + velocity + 0.2f*vec3(gen.next_float() - 0.5f, gen.next_float() - 0.5f, gen.next_float() - 0.5f);
+        }
+        list[i] = a.make<moving_triangle>(start, end, 0.0f, 1.0f, mat);
+    }
+    s.world = a.make<bvh>(list, n, 0.0f, 1.0f);
+    s.lookfrom = vec3(0.0f, 3.0f, 12.0f);
+    s.lookat = vec3(0.0f, 1.0f, 0.0f);
+    s.vfov = 35.0f;
+    s.light_pos = vec3(10.0f, 10.0f, 10.0f);
+    return s;
+}
+
+/* Generated scenes of any size for benchmarks, named random_spheres:N and
+   random_triangles:N. The primitives fill a cube at constant density, so the
+   camera sees a similar picture at every N and only the depth of the bvh
+   grows. A handful of shared materials keeps large scenes small. */
+const float GENERATED_SPACING = 2.0f;  // mean distance between neighbouring primitives
+
+void frame_generated(scene& s, float side)
+{
+    s.lookfrom = vec3(0.6f*side, 0.5f*side, 1.4f*side);
+    s.lookat = vec3(0.0f, 0.0f, 0.0f);
+    s.vfov = 40.0f;
+    s.light_pos = vec3(side, 2.0f*side, side);
+}
+
+scene random_spheres(int n)
+{
+    scene s;
+    arena& a = *s.objects;
+    float side = GENERATED_SPACING*cbrtf(float(n));
+    material *mats[4] = { a.make<lambertian>(a.make<constant_texture>(vec3(0.8f, 0.3f, 0.3f))),
+                          a.make<lambertian>(a.make<constant_texture>(vec3(0.3f, 0.8f, 0.3f))),
+                          a.make<lambertian>(a.make<constant_texture>(vec3(0.3f, 0.3f, 0.8f))),
+                          a.make<metal>(vec3(0.8f, 0.8f, 0.8f), 0.1f) };
+    std::vector<sphere> spheres(n);
+    std::vector<sphere*> pointers(n);
+    rng gen(RENDER_SEED);
+    for (int i = 0; i < n; ++i)
+    {
+        vec3 center(side*(gen.next_float() - 0.5f), side*(gen.next_float() - 0.5f), side*(gen.next_float() - 0.5f));
+        spheres[i] = sphere(center, 0.3f, mats[i % 4]);
+        pointers[i] = &spheres[i];
+    }
+    std::vector<hitable*> list;
+    make_sphere_sets(&pointers[0], n, list, a);
+    s.world = a.make<bvh>(&list[0], (int)list.size(), 0.0f, 1.0f);
+    frame_generated(s, side);
+    return s;
+}
+
+// n small triangles scattered through a cube of the given side centred on the origin
+hitable **generateTriangles(arena& a, rng& gen, int n, float side)
+{
+    material *mats[4] = { a.make<lambertian>(a.make<constant_texture>(vec3(0.8f, 0.3f, 0.3f))),
+                          a.make<lambertian>(a.make<constant_texture>(vec3(0.3f, 0.8f, 0.3f))),
+                          a.make<lambertian>(a.make<constant_texture>(vec3(0.3f, 0.3f, 0.8f))),
+                          a.make<metal>(vec3(0.8f, 0.8f, 0.8f), 0.1f) };
+    hitable **list = a.make_array<hitable*>(n);
+    for (int i = 0; i < n; ++i)
+    {
+        vec3 center(side*(gen.next_float() - 0.5f), side*(gen.next_float() - 0.5f), side*(gen.next_float() - 0.5f));
+        vec3 v[3];
+        for (int k = 0; k < 3; ++k)
+            v[k] = center + 0.8f*vec3(gen.next_float() - 0.5f, gen.next_float() - 0.5f, gen.next_float() - 0.5f);
+        list[i] = a.make<triangle>(v[0], v[1], v[2], mats[i % 4]);
+    }
+    return list;
+}
+
+scene random_triangles(int n)
+{
+    scene s;
+    arena& a = *s.objects;
+    float side = GENERATED_SPACING*cbrtf(float(n));
+    rng gen(RENDER_SEED);
+    s.world = a.make<bvh>(generateTriangles(a, gen, n, side), n, 0.0f, 1.0f);
+    frame_generated(s, side);
+    return s;
+}
+
+const int INSTANCED_TRIANGLES = 1000;  // unique triangles of random_instances
+
+// n copies of one cluster of random triangles, each turned, scaled and moved to its
+// own cell of a jittered grid, so only INSTANCED_TRIANGLES triangles are stored
+scene random_instances(int n)
+{
+    scene s;
+    arena& a = *s.objects;
+    float cluster = GENERATED_SPACING*cbrtf(float(INSTANCED_TRIANGLES));
+    rng gen(RENDER_SEED);
+    hitable *shared = a.make<bvh>(generateTriangles(a, gen, INSTANCED_TRIANGLES, cluster), INSTANCED_TRIANGLES, 0.0f, 1.0f);
+
+    int k = 1;
+    while (k*k*k < n)
+        k++;
+    float pitch = 1.5f*cluster;
+    float side = k*pitch;
+    hitable **list = a.make_array<hitable*>(n);
+    for (int i = 0; i < n; ++i)
+    {
+        vec3 cell(float(i % k), float(i / k % k), float(i / (k*k)));
+        vec3 jitter(gen.next_float() - 0.5f, gen.next_float() - 0.5f, gen.next_float() - 0.5f);
+        vec3 center = pitch*(cell + vec3(0.5f, 0.5f, 0.5f) + 0.2f*jitter) - vec3(0.5f*side, 0.5f*side, 0.5f*side);
+        vec3 axis(gen.next_float() - 0.5f, gen.next_float() - 0.5f, gen.next_float() - 0.5f);
+        float angle = 360.0f*gen.next_float();
+        float size = 0.7f + 0.6f*gen.next_float();
+        transform world = transform::translate(center) * transform::rotate(axis, angle) * transform::scale(vec3(size, size, size));
+        list[i] = a.make<instance>(shared, world);
+    }
+    s.world = a.make<bvh>(list, n, 0.0f, 1.0f);
+    frame_generated(s, side);
+    return s;
+}
+
+// A Wavefront OBJ model standing on the checkered ground, with the camera framing it
+scene obj_scene(const std::string& file_name)
+{
+    scene s;
+    arena& a = *s.objects;
+    mesh *model = load_obj(file_name, a.make<lambertian>(a.make<constant_texture>(vec3(0.8f, 0.8f, 0.8f))), a);
+    if (!model)
+        return scene();
+    std::cout << "Loaded " << model->num_faces() << " triangles from " << file_name << std::endl;
+
+    aabb box;
+    model->bounding_box(0.0f, 1.0f, box);
+    float size = (box.max() - box.min()).length();
+
+    hitable **list = a.make_array<hitable*>(2);
+    texture *checker = a.make<checker_texture>(a.make<constant_texture>(vec3(0.3, 0.3, 0.3)), a.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = a.make<sphere>(vec3(box.centroid().x(), box.min().y() - 1000.0f, box.centroid().z()), 1000.0f, a.make<lambertian>(checker));
+    list[1] = model;
+    s.world = a.make<bvh>(list, 2, 0.0f, 1.0f);
+    s.lookat = box.centroid();
+    s.lookfrom = s.lookat + 3.0f * size * unit_vector(vec3(1.0f, 0.7f, 0.6f));
+    return s;
+}
+
+// Scenes that can be picked by name on the command line
+struct scene_entry
+{
+    const char *name;
+    scene (*build)();
+};
+
+const scene_entry SCENES[] = {
+    { "cornell_box_test", cornell_box_test },
+    { "reflect_diffuse_test", reflect_diffuse_test },
+    { "fresnel_test", fresnel_test },
+    { "beer_test", beer_test },
+    { "soft_shadow_test", soft_shadow_test },
+    { "pyramid_test", pyramid_test },
+    { "many_spheres_test", many_spheres_test },
+    { "area_light_test", area_light_test },
+    { "perlin_test", perlin_test },
+    { "worley_test", worley_test },
+    { "motion_blur_test", motion_blur_test },
+};
+const int NUM_SCENES = sizeof(SCENES) / sizeof(SCENES[0]);
 
-    return new hitable_list(list, 5);
+inline bool has_extension(const std::string& name, const std::string& ext)
+{
+    return name.size() > ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// Scenes read from files rather than built by a function above
+inline bool is_scene_file(const std::string& name)
+{
+    return has_extension(name, ".obj") || has_extension(name, ".scene");
+}
+
+// The world is null if there is no scene with that name. Names ending in .obj are loaded
+// as models, names ending in .scene as scene files (see scene_file.h), and
+// random_spheres:N, random_triangles:N and random_instances:N are generated
+scene build_scene(const std::string& name)
+{
+    if (has_extension(name, ".obj"))
+        return obj_scene(name);
+    if (has_extension(name, ".scene"))
+        return load_scene_file(name);
+    size_t colon = name.find(':');
+    if (colon != std::string::npos)
+    {
+        int n = atoi(name.c_str() + colon + 1);
+        std::string kind = name.substr(0, colon);
+        if (n > 0 && kind == "random_spheres")
+            return random_spheres(n);
+        if (n > 0 && kind == "random_triangles")
+            return random_triangles(n);
+        if (n > 0 && kind == "random_instances")
+            return random_instances(n);
+        return scene();
+    }
+    for (int i = 0; i < NUM_SCENES; ++i)
+    {
+        if (name == SCENES[i].name)
+            return SCENES[i].build();
+    }
+    return scene();
 }
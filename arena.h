@@ -0,0 +1,106 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* Bump allocator that owns the objects of a scene. Objects are placed one
+   after another in the order they are made, so primitives built together sit
+   next to their materials and textures instead of being scattered through the
+   heap. Nothing is freed on its own: destroying the arena runs the destructors
+   of the objects that need one and releases the blocks. Blocks double in size,
+   so even a large scene lives in a handful of them. */
+class arena
+{
+ public:
+  explicit arena(size_t first_block = 64 * 1024)
+    : cursor(nullptr), limit(nullptr), next_block(first_block), used(0), cleanups(nullptr) {}
+  ~arena();
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  template <typename T, typename... Args>
+  T *make(Args&&... args);
+  // Uninitialised room for n objects that need no destructor, such as pointers
+  template <typename T>
+  T *make_array(size_t n);
+
+  void *allocate(size_t size, size_t align);
+  size_t bytes_used() const { return used; }
+
+ private:
+  // Kept in the arena itself, newest first, so objects are destroyed in reverse order
+  struct cleanup
+  {
+    void (*destroy)(void *);
+    void *object;
+    cleanup *next;
+  };
+
+  template <typename T>
+  static void destroy(void *object) { static_cast<T *>(object)->~T(); }
+
+  std::vector<char *> blocks;
+  char *cursor;
+  char *limit;
+  size_t next_block;
+  size_t used;
+  cleanup *cleanups;
+};
+
+arena::~arena()
+{
+  for (cleanup *c = cleanups; c; c = c->next)
+    c->destroy(c->object);
+  for (size_t i = 0; i < blocks.size(); ++i)
+    free(blocks[i]);
+}
+
+void *arena::allocate(size_t size, size_t align)
+{
+  uintptr_t p = ((uintptr_t)cursor + align - 1) & ~(uintptr_t)(align - 1);
+  if (!cursor || p + size > (uintptr_t)limit)
+    {
+      size_t block = std::max(next_block, size + align);
+      char *memory = (char *)malloc(block);
+      if (!memory)
+	throw std::bad_alloc();
+      blocks.push_back(memory);
+      cursor = memory;
+      limit = memory + block;
+      next_block *= 2;
+      p = ((uintptr_t)cursor + align - 1) & ~(uintptr_t)(align - 1);
+    }
+  cursor = (char *)(p + size);
+  used += size;
+  return (void *)p;
+}
+
+template <typename T, typename... Args>
+T *arena::make(Args&&... args)
+{
+  T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  if (!std::is_trivially_destructible<T>::value)
+    {
+      cleanup *c = new (allocate(sizeof(cleanup), alignof(cleanup))) cleanup;
+      c->destroy = &arena::destroy<T>;
+      c->object = object;
+      c->next = cleanups;
+      cleanups = c;
+    }
+  return object;
+}
+
+template <typename T>
+T *arena::make_array(size_t n)
+{
+  static_assert(std::is_trivially_destructible<T>::value, "arrays are never destroyed");
+  return (T *)allocate(n * sizeof(T), alignof(T));
+}
+
+#endif
@@ -0,0 +1,463 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include "render.h"
+#include "wavefront.h"
+#include "tile_scheduler.h"
+
+/* Benchmarks: nanoseconds per call of the intersection routines, materials and
+   vector math, then rays per second of whole renders of the built in scenes and
+   of generated scenes of 10^3 up to --max-primitives primitives, at 1, 2, 4 ...
+   threads up to --threads. Results can be written as json and checked against
+   an earlier run with --baseline, which fails when any of them got slower by
+   more than --tolerance. */
+
+struct bench_options
+{
+    bench_options()
+        : suite("all"), scenes(""), max_primitives(1000000), threads(0), width(160), height(120), samples(4),
+          mode(LIGHT_GLOBAL), wavefront(0), repeat(3), json(""), baseline(""), tolerance(0.1f) {}
+
+    std::string suite;       // micro, scenes or all
+    std::string scenes;      // comma separated, empty for every built in and generated scene
+    int max_primitives;
+    int threads;             // most threads to scale to, 0 for every hardware thread
+    int width, height, samples;
+    lighting_mode mode;
+    int wavefront;           // paths per wave, 0 for the path at a time integrator
+    int repeat;              // the best of this many runs is kept
+    std::string json;
+    std::string baseline;
+    float tolerance;         // relative slowdown that counts as a regression
+};
+
+// One line of the report. Micro benchmarks measure ns per call, scenes rays per second
+struct bench_result
+{
+    std::string name;
+    int threads;
+    double value;
+    bool higher_is_better;
+    double efficiency;       // rays per second per thread relative to one thread, scenes only
+};
+
+void printBenchUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --suite S             micro, scenes or all (default all)\n"
+              << "  --scenes A,B,...      scenes to render, built in, files or generated like\n"
+              << "                        random_spheres:10000 (default every built in scene and\n"
+              << "                        the generated ones)\n"
+              << "  --max-primitives N    largest generated scene (default 1000000)\n"
+              << "  --threads N           most threads to scale to, 0 for all (default 0)\n"
+              << "  --width N             (default 160)\n"
+              << "  --height N            (default 120)\n"
+              << "  --samples N           samples per pixel (default 4)\n"
+              << "  --mode MODE           direct, shadows or global (default global)\n"
+              << "  --wavefront N         render with the wavefront integrator, N paths per wave\n"
+              << "  --repeat N            keep the best of N runs (default 3)\n"
+              << "  --json FILE           write the results\n"
+              << "  --baseline FILE       compare with the results of an earlier --json\n"
+              << "  --tolerance T         relative slowdown counted as a regression (default 0.1)\n";
+}
+
+bool parseBenchArgs(int argc, char **argv, bench_options& o)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+        {
+            printBenchUsage(argv[0]);
+            return false;
+        }
+        std::string value = argv[++i];
+        int n = atoi(value.c_str());
+
+        if (arg == "--suite") o.suite = value;
+        else if (arg == "--scenes") o.scenes = value;
+        else if (arg == "--max-primitives") o.max_primitives = n;
+        else if (arg == "--threads") o.threads = n;
+        else if (arg == "--width") o.width = n;
+        else if (arg == "--height") o.height = n;
+        else if (arg == "--samples") o.samples = n;
+        else if (arg == "--wavefront") o.wavefront = n;
+        else if (arg == "--repeat") o.repeat = std::max(1, n);
+        else if (arg == "--json") o.json = value;
+        else if (arg == "--baseline") o.baseline = value;
+        else if (arg == "--tolerance") o.tolerance = (float)atof(value.c_str());
+        else if (arg == "--mode")
+        {
+            if (!parse_mode(value, o.mode))
+            {
+                std::cerr << "Unknown mode " << value << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            printBenchUsage(argv[0]);
+            return false;
+        }
+    }
+    if (o.suite != "micro" && o.suite != "scenes" && o.suite != "all")
+    {
+        std::cerr << "Unknown suite " << o.suite << std::endl;
+        return false;
+    }
+    return true;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Stops the compiler from dropping work whose result is never used
+volatile float BENCH_SINK;
+
+const int BENCH_RAYS = 1024;
+
+// Best nanoseconds per call of f(i) over repeat runs, each long enough to time reliably
+template <typename F>
+double nsPerCall(F f, int repeat)
+{
+    int calls = BENCH_RAYS;
+    double best = 0.0;
+    for (int run = 0; run < repeat; ++run)
+    {
+        double seconds;
+        for (;;)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            float sum = 0.0f;
+            for (int i = 0; i < calls; ++i)
+                sum += f(i % BENCH_RAYS);
+            BENCH_SINK = sum;
+            seconds = secondsSince(start);
+            if (seconds > 0.05)
+                break;
+            calls *= 2;
+        }
+        double ns = seconds * 1e9 / calls;
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+// Rays from a box in front of the origin towards the unit cube around it, so about half of them hit a unit primitive
+std::vector<ray> benchRays()
+{
+    rng gen(RENDER_SEED);
+    std::vector<ray> rays(BENCH_RAYS);
+    for (int i = 0; i < BENCH_RAYS; ++i)
+    {
+        vec3 from(4.0f*gen.next_float() - 2.0f, 4.0f*gen.next_float() - 2.0f, 5.0f);
+        vec3 to(3.0f*gen.next_float() - 1.5f, 3.0f*gen.next_float() - 1.5f, 0.0f);
+        rays[i] = ray(from, unit_vector(to - from), 0.0f);
+    }
+    return rays;
+}
+
+void runMicro(const bench_options& o, std::vector<bench_result>& results)
+{
+    std::vector<ray> rays = benchRays();
+    arena a;
+    lambertian *diffuse = a.make<lambertian>(a.make<constant_texture>(vec3(0.5f, 0.5f, 0.5f)));
+    metal *mirror = a.make<metal>(vec3(0.8f, 0.8f, 0.8f), 0.1f);
+    dielectric *glass = a.make<dielectric>(1.5f);
+
+    sphere ball(vec3(0.0f, 0.0f, 0.0f), 1.0f, diffuse);
+    triangle tri(vec3(-1.0f, -1.0f, 0.0f), vec3(1.0f, -1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), diffuse);
+    plane quad(vec3(0.0f, 0.0f, 0.0f), 2.0f, 2.0f, vec3(0.0f, 0.0f, 1.0f), diffuse);
+
+    // A list of 16 small spheres on a grid, the way the old scenes were traced before the bvh
+    hitable *spheres[16];
+    for (int i = 0; i < 16; ++i)
+        spheres[i] = a.make<sphere>(vec3(-1.5f + (i % 4), -1.5f + (i / 4), 0.0f), 0.4f, diffuse);
+    hitable_list list(spheres, 16);
+
+    // Every ray gets a hit to scatter from where it crosses the plane z = 0
+    std::vector<hit_record> recs(BENCH_RAYS);
+    for (int i = 0; i < BENCH_RAYS; ++i)
+    {
+        recs[i].t = -rays[i].origin().z() / rays[i].direction().z();
+        recs[i].p = rays[i].point_at_parameter(recs[i].t);
+        recs[i].normal = vec3(0.0f, 0.0f, 1.0f);
+        recs[i].u = recs[i].v = 0.0f;
+    }
+    std::vector<vec3> vecs(BENCH_RAYS);
+    for (int i = 0; i < BENCH_RAYS; ++i)
+        vecs[i] = rays[i].direction() * float(i % 7 + 1);
+    const vec3 light(0.0f, 5.0f, 5.0f);
+
+    struct micro
+    {
+        const char *name;
+        double ns;
+    };
+    std::vector<micro> runs;
+    hit_record rec;
+    runs.push_back({ "sphere_hit", nsPerCall([&](int i) { return ball.hit(rays[i], 0.001f, FLT_MAX, rec) ? rec.t : 0.0f; }, o.repeat) });
+    runs.push_back({ "triangle_hit", nsPerCall([&](int i) { return tri.hit(rays[i], 0.001f, FLT_MAX, rec) ? rec.t : 0.0f; }, o.repeat) });
+    runs.push_back({ "plane_hit", nsPerCall([&](int i) { return quad.hit(rays[i], 0.001f, FLT_MAX, rec) ? rec.t : 0.0f; }, o.repeat) });
+    runs.push_back({ "hitable_list_hit_16", nsPerCall([&](int i) { return list.hit(rays[i], 0.001f, FLT_MAX, rec) ? rec.t : 0.0f; }, o.repeat) });
+
+    material *mats[3] = { diffuse, mirror, glass };
+    const char *mat_names[3] = { "lambertian_scatter", "metal_scatter", "dielectric_scatter" };
+    for (int m = 0; m < 3; ++m)
+    {
+        for (int i = 0; i < BENCH_RAYS; ++i)
+            recs[i].mat_ptr = mats[m];
+        runs.push_back({ mat_names[m], nsPerCall([&](int i) {
+                                                     vec3 attenuation;
+                                                     ray scattered;
+                                                     material_scatter(recs[i].mat_ptr, rays[i], recs[i], attenuation, scattered, light);
+                                                     return scattered.direction().x() + attenuation.x();
+                                                 }, o.repeat) });
+    }
+
+    runs.push_back({ "vec3_dot", nsPerCall([&](int i) { return dot(vecs[i], vecs[(i + 1) % BENCH_RAYS]); }, o.repeat) });
+    runs.push_back({ "vec3_cross", nsPerCall([&](int i) { return cross(vecs[i], vecs[(i + 1) % BENCH_RAYS]).x(); }, o.repeat) });
+    runs.push_back({ "vec3_unit_vector", nsPerCall([&](int i) { return unit_vector(vecs[i]).x(); }, o.repeat) });
+    runs.push_back({ "vec3_arithmetic", nsPerCall([&](int i) { return (vecs[i] * 2.0f + vecs[(i + 1) % BENCH_RAYS] - vecs[(i + 2) % BENCH_RAYS] / 3.0f).y(); }, o.repeat) });
+
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        std::cout << "  " << runs[i].name << ": " << runs[i].ns << " ns" << std::endl;
+        bench_result r = { runs[i].name, 1, runs[i].ns, false, 1.0 };
+        results.push_back(r);
+    }
+}
+
+// Rays per second of one render of sc at the given number of threads
+template <lighting_mode MODE>
+double renderRate(const scene& sc, camera& cam, int threads)
+{
+    CANVAS = framebuffer(SETTINGS.width, SETTINGS.height);
+    STATS.reset();
+    tile_scheduler scheduler(SETTINGS.width, SETTINGS.height, SETTINGS.tile_size, threads);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    scheduler.run([&](const tile& t) { traceTile<MODE>(t.x0, t.x1, t.y0, t.y1, sc, cam); },
+                  [](double) {});
+    double seconds = secondsSince(start);
+    return seconds > 0.0 ? STATS.merged().total_rays() / seconds : 0.0;
+}
+
+double renderRate(const scene& sc, camera& cam, int threads)
+{
+    switch (SETTINGS.mode)
+    {
+    case LIGHT_SHADOWS: return renderRate<LIGHT_SHADOWS>(sc, cam, threads);
+    case LIGHT_GLOBAL: return renderRate<LIGHT_GLOBAL>(sc, cam, threads);
+    default: return renderRate<LIGHT_DIRECT>(sc, cam, threads);
+    }
+}
+
+std::vector<std::string> benchScenes(const bench_options& o)
+{
+    std::vector<std::string> names;
+    if (!o.scenes.empty())
+    {
+        std::stringstream list(o.scenes);
+        std::string name;
+        while (std::getline(list, name, ','))
+            if (!name.empty())
+                names.push_back(name);
+        return names;
+    }
+    for (int i = 0; i < NUM_SCENES; ++i)
+        names.push_back(SCENES[i].name);
+    for (int n = 1000; n <= o.max_primitives; n *= 10)
+    {
+        names.push_back("random_spheres:" + std::to_string(n));
+        names.push_back("random_triangles:" + std::to_string(n));
+        // As many triangles, all of them copies of the same INSTANCED_TRIANGLES
+        names.push_back("random_instances:" + std::to_string(n / INSTANCED_TRIANGLES));
+    }
+    return names;
+}
+
+bool runScenes(const bench_options& o, std::vector<bench_result>& results)
+{
+    SETTINGS.width = o.width;
+    SETTINGS.height = o.height;
+    SETTINGS.samples = o.samples;
+    SETTINGS.mode = o.mode;
+    SETTINGS.wavefront = o.wavefront;
+
+    // 1, 2, 4 ... and the most threads asked for, which need not be a power of two
+    int most = o.threads > 0 ? o.threads : default_thread_count();
+    std::vector<int> thread_counts;
+    for (int t = 1; t < most; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(most);
+
+    std::vector<std::string> names = benchScenes(o);
+    for (size_t s = 0; s < names.size(); ++s)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        scene sc = build_scene(names[s]);
+        if (!sc.world)
+        {
+            std::cerr << "Unknown scene " << names[s] << std::endl;
+            return false;
+        }
+        std::cout << "  " << names[s] << " (built in " << secondsSince(start) << " s)" << std::endl;
+        camera cam = sc.make_camera(float(o.width) / float(o.height));
+
+        double single = 0.0;
+        for (size_t t = 0; t < thread_counts.size(); ++t)
+        {
+            double best = 0.0;
+            for (int run = 0; run < o.repeat; ++run)
+                best = std::max(best, renderRate(sc, cam, thread_counts[t]));
+            if (t == 0)
+                single = best;
+            double efficiency = single > 0.0 ? best / (single * thread_counts[t]) : 0.0;
+            std::cout << "    " << thread_counts[t] << " threads: " << best / 1e6 << " Mrays/s, "
+                      << 100.0 * efficiency << "% efficiency" << std::endl;
+            bench_result r = { names[s], thread_counts[t], best, true, efficiency };
+            results.push_back(r);
+        }
+    }
+    return true;
+}
+
+// One result per line, so the baseline can be read back a line at a time
+void writeBenchJson(const std::string& file_name, const bench_options& o, const std::vector<bench_result>& results)
+{
+    std::ofstream out(file_name.c_str());
+    out << "{\n";
+    out << "  \"width\": " << o.width << ",\n";
+    out << "  \"height\": " << o.height << ",\n";
+    out << "  \"samples\": " << o.samples << ",\n";
+    out << "  \"mode\": \"" << mode_name(o.mode) << "\",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const bench_result& r = results[i];
+        out << "    { \"name\": \"" << json_escape(r.name) << "\", \"threads\": " << r.threads;
+        if (r.higher_is_better)
+            out << ", \"rays_per_second\": " << r.value << ", \"efficiency\": " << r.efficiency;
+        else
+            out << ", \"ns_per_call\": " << r.value;
+        out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// The value after "key": on line, strings unescaped, empty if the key is not there
+std::string jsonField(const std::string& line, const std::string& key)
+{
+    std::string quoted = "\"" + key + "\": ";
+    size_t at = line.find(quoted);
+    if (at == std::string::npos)
+        return "";
+    at += quoted.size();
+    if (at < line.size() && line[at] == '"')
+    {
+        // Undoes json_escape(), the string ends at the first quote that is not escaped
+        std::string value;
+        for (size_t i = at + 1; i < line.size() && line[i] != '"'; ++i)
+        {
+            if (line[i] != '\\' || i + 1 >= line.size())
+            {
+                value += line[i];
+                continue;
+            }
+            char c = line[++i];
+            if (c == 'n')
+                value += '\n';
+            else if (c == 't')
+                value += '\t';
+            else if (c == 'r')
+                value += '\r';
+            else if (c == 'u' && i + 4 < line.size())
+            {
+                value += char(strtol(line.substr(i + 1, 4).c_str(), nullptr, 16));
+                i += 4;
+            }
+            else
+                value += c;
+        }
+        return value;
+    }
+    return line.substr(at, line.find_first_of(",}", at) - at);
+}
+
+// Number of results more than tolerance slower than in the baseline file, -1 if it cannot be read
+int compareBaseline(const std::string& file_name, float tolerance, const std::vector<bench_result>& results)
+{
+    std::ifstream in(file_name.c_str());
+    if (!in)
+    {
+        std::cerr << "Cannot read baseline " << file_name << std::endl;
+        return -1;
+    }
+    int regressions = 0;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::string name = jsonField(line, "name");
+        if (name.empty())
+            continue;
+        int threads = atoi(jsonField(line, "threads").c_str());
+        std::string rate = jsonField(line, "rays_per_second");
+        double before = atof((rate.empty() ? jsonField(line, "ns_per_call") : rate).c_str());
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const bench_result& r = results[i];
+            if (r.name != name || r.threads != threads || r.higher_is_better != !rate.empty() || before <= 0.0)
+                continue;
+            // Positive when slower, for both rates and times
+            double slowdown = r.higher_is_better ? before / r.value - 1.0 : r.value / before - 1.0;
+            if (slowdown > tolerance)
+            {
+                std::cout << "Regression: " << name << " at " << threads << " threads is "
+                          << 100.0 * slowdown << "% slower than the baseline" << std::endl;
+                regressions++;
+            }
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv)
+{
+    bench_options options;
+    if (!parseBenchArgs(argc, argv, options))
+        return 1;
+
+    std::vector<bench_result> results;
+    if (options.suite != "scenes")
+    {
+        std::cout << "Micro benchmarks:" << std::endl;
+        runMicro(options, results);
+    }
+    if (options.suite != "micro")
+    {
+        std::cout << "Scenes at " << options.width << "x" << options.height << ", " << options.samples
+                  << " samples per pixel, " << mode_name(options.mode) << " lighting:" << std::endl;
+        if (!runScenes(options, results))
+            return 1;
+    }
+
+    if (!options.json.empty())
+        writeBenchJson(options.json, options, results);
+    if (!options.baseline.empty())
+    {
+        int regressions = compareBaseline(options.baseline, options.tolerance, results);
+        if (regressions != 0)
+            return 1;
+        std::cout << "No regressions against " << options.baseline << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,513 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include "hitable.h"
+#include "simd.h"
+
+/* Bounding volume hierarchy built with the surface area heuristic.
+   Nodes are stored flattened in depth first order: the first child of an
+   interior node directly follows it, so only the second child's index is kept.
+   Primitives without a bounding box (infinite planes) are kept to the side
+   and tested linearly for every ray.
+
+   When anything in the tree moves, every node also keeps its box at time1 in
+   end_boxes, and rays are tested against the node box interpolated to their
+   time. A box around a fast mover's whole sweep would be hit by most rays
+   that pass anywhere near its path; the interpolated box only by rays that
+   pass near where it is at their time. Static trees leave end_boxes empty and
+   traverse exactly as before. */
+
+struct bvh_node
+{
+  aabb box;
+  int offset;    // first primitive for leaves, second child for interior nodes
+  short count;   // number of primitives in a leaf, 0 for interior nodes
+  short axis;    // split axis, used to visit the nearer child first
+};
+
+class bvh : public hitable
+{
+ public:
+  bvh() : time0(0.0f), time1(1.0f), segments(1) {}
+  bvh(hitable **l, int n, float t0, float t1);
+  virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual bool motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const;
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
+
+  std::vector<bvh_node> nodes;
+  std::vector<aabb> end_boxes;     // box of every node at time1, empty when nothing moves
+  std::vector<hitable*> prims;     // ordered so that every leaf is a contiguous range
+  std::vector<hitable*> unbounded;
+  float time0, time1;              // shutter interval the boxes bound
+  int segments;                    // trees the interval is cut into, one each
+  std::vector<int> roots;          // root node of every segment's tree
+
+ private:
+  struct prim_info
+  {
+    aabb box;        // at time0
+    aabb end_box;    // at time1
+    vec3 centroid;   // of the box halfway through the interval
+    hitable *prim;
+  };
+
+  // How far through the interval time is, clamped since the boxes only bound the interval
+  float shutter(float time) const
+  {
+    return time1 > time0 ? ffmin(1.0f, ffmax(0.0f, (time - time0) / (time1 - time0))) : 0.0f;
+  }
+
+  // Root of the tree for time, with how far through that tree's segment it is in s
+  int segment_root(float time, float& s) const
+  {
+    float f = shutter(time) * segments;
+    int k = std::min(int(f), segments - 1);
+    s = f - k;
+    return roots[k];
+  }
+
+  int build(std::vector<prim_info>& info, int start, int end, int depth);
+  template <bool MOVING>
+  bool closest_hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+  template <bool MOVING>
+  bool any_hit(const ray& r, float t_min, float t_max) const;
+
+  static const int NUM_BINS = 16;
+  static const int MAX_LEAF_SIZE = 4;
+  static const int MAX_DEPTH = 64;
+  static const int MAX_SEGMENTS = 8;
+};
+
+// std::min takes it by reference, which needs a definition
+const int bvh::MAX_SEGMENTS;
+
+bvh::bvh(hitable **l, int n, float t0, float t1) : time0(t0), time1(t1), segments(1)
+{
+  std::vector<prim_info> info;
+  info.reserve(n);
+  bool moving = false;
+  float travel = 0.0f;  // sum over the primitives of how many times its size each travels
+  for (int i = 0; i < n; ++i)
+    {
+      prim_info p;
+      if (l[i]->motion_bounds(time0, time1, p.box, p.end_box))
+	{
+	  p.centroid = 0.5f*(p.box.centroid() + p.end_box.centroid());
+	  p.prim = l[i];
+	  moving = moving || !same_box(p.box, p.end_box);
+	  float size = (p.box.max() - p.box.min()).length();
+	  if (size > 0.0f)
+	    travel += (p.end_box.centroid() - p.box.centroid()).length() / size;
+	  info.push_back(p);
+	}
+      else
+	{
+	  unbounded.push_back(l[i]);
+	}
+    }
+  if (info.empty())
+    return;
+
+  /* Primitives that are close halfway through the interval, and so share
+     nodes, can be far apart at its ends, where the node boxes are kept. Once
+     they travel further than their own size the interpolated boxes grow loose,
+     so the interval is cut into segments over which they travel about their
+     size, and every segment gets a tree of its own. */
+  if (moving)
+    segments = std::max(1, std::min(MAX_SEGMENTS, int(travel / info.size() + 0.5f)));
+  nodes.reserve(2 * segments * info.size());
+  end_boxes.reserve(2 * segments * info.size());
+  prims.reserve(segments * info.size());
+  for (int k = 0; k < segments; ++k)
+    {
+      if (segments > 1)
+	{
+	  float ta = time0 + (time1 - time0) * k / segments;
+	  float tb = time0 + (time1 - time0) * (k + 1) / segments;
+	  for (size_t i = 0; i < info.size(); ++i)
+	    {
+	      info[i].prim->motion_bounds(ta, tb, info[i].box, info[i].end_box);
+	      info[i].centroid = 0.5f*(info[i].box.centroid() + info[i].end_box.centroid());
+	    }
+	}
+      roots.push_back(build(info, 0, (int)info.size(), 0));
+    }
+  if (!moving)
+    std::vector<aabb>().swap(end_boxes);
+}
+
+int bvh::build(std::vector<prim_info>& info, int start, int end, int depth)
+{
+  int node_index = (int)nodes.size();
+  nodes.push_back(bvh_node());
+  end_boxes.push_back(aabb());
+
+  aabb bounds, end_bounds, centroid_bounds;
+  for (int i = start; i < end; ++i)
+    {
+      bounds.expand(info[i].box);
+      end_bounds.expand(info[i].end_box);
+      centroid_bounds.expand(info[i].centroid);
+    }
+  nodes[node_index].box = bounds;
+  end_boxes[node_index] = end_bounds;
+
+  int n = end - start;
+  int axis = centroid_bounds.longest_axis();
+  float cmin = centroid_bounds.min()[axis];
+  float cmax = centroid_bounds.max()[axis];
+
+  int mid = -1;
+  if (n > 1 && cmax > cmin)
+    {
+      /* Bin the centroids and evaluate the SAH cost at every bin boundary. The
+	 area of a moving node is averaged over its boxes at the two ends, which
+	 for static primitives is just the area of the box */
+      struct bin { aabb box, end_box; int count; } bins[NUM_BINS];
+      for (int b = 0; b < NUM_BINS; ++b)
+	bins[b].count = 0;
+
+      float scale = NUM_BINS / (cmax - cmin);
+      for (int i = start; i < end; ++i)
+	{
+	  int b = std::min(NUM_BINS - 1, int((info[i].centroid[axis] - cmin) * scale));
+	  bins[b].count++;
+	  bins[b].box.expand(info[i].box);
+	  bins[b].end_box.expand(info[i].end_box);
+	}
+
+      float right_area[NUM_BINS];
+      int right_count[NUM_BINS];
+      aabb acc, end_acc;
+      int count = 0;
+      for (int b = NUM_BINS - 1; b > 0; --b)
+	{
+	  acc.expand(bins[b].box);
+	  end_acc.expand(bins[b].end_box);
+	  count += bins[b].count;
+	  right_area[b] = 0.5f*(acc.surface_area() + end_acc.surface_area());
+	  right_count[b] = count;
+	}
+
+      float best_cost = FLT_MAX;
+      int best_split = -1;
+      acc = end_acc = aabb();
+      count = 0;
+      for (int b = 1; b < NUM_BINS; ++b)
+	{
+	  acc.expand(bins[b - 1].box);
+	  end_acc.expand(bins[b - 1].end_box);
+	  count += bins[b - 1].count;
+	  float cost = count * 0.5f*(acc.surface_area() + end_acc.surface_area()) + right_count[b] * right_area[b];
+	  if (count > 0 && right_count[b] > 0 && cost < best_cost)
+	    {
+	      best_cost = cost;
+	      best_split = b;
+	    }
+	}
+
+      // Traversal is taken to cost about as much as one intersection test
+      float leaf_cost = float(n);
+      float split_cost = 1.0f + best_cost / (0.5f*(bounds.surface_area() + end_bounds.surface_area()));
+      if (best_split > 0 && (n > MAX_LEAF_SIZE || split_cost < leaf_cost))
+	{
+	  prim_info *split = std::partition(&info[start], &info[end - 1] + 1,
+					    [=](const prim_info& p) {
+					      int b = std::min(NUM_BINS - 1, int((p.centroid[axis] - cmin) * scale));
+					      return b < best_split;
+					    });
+	  mid = int(split - &info[0]);
+	}
+    }
+
+  // Centroids all coincide, or the tree is getting too deep: halve by count instead
+  if (mid < 0 && n > MAX_LEAF_SIZE)
+    mid = start + n / 2;
+  if (mid > start && depth >= MAX_DEPTH - 24)
+    mid = start + n / 2;
+
+  if (mid <= start || mid >= end)
+    {
+      nodes[node_index].offset = (int)prims.size();
+      nodes[node_index].count = (short)n;
+      nodes[node_index].axis = 0;
+      for (int i = start; i < end; ++i)
+	prims.push_back(info[i].prim);
+      return node_index;
+    }
+
+  build(info, start, mid, depth + 1);
+  int second = build(info, mid, end, depth + 1);
+  nodes[node_index].offset = second;
+  nodes[node_index].count = 0;
+  nodes[node_index].axis = (short)axis;
+  return node_index;
+}
+
+// hit() with MOVING known at compile time, so static trees test their boxes as they are
+template <bool MOVING>
+bool bvh::closest_hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+  bool hit_anything = false;
+  float closest_so_far = t_max;
+  for (size_t i = 0; i < unbounded.size(); ++i)
+    {
+      if (hit_primitive(unbounded[i], r, t_min, closest_so_far, rec))
+	{
+	  hit_anything = true;
+	  closest_so_far = rec.t;
+	}
+    }
+  if (nodes.empty())
+    return hit_anything;
+
+  vec3 origin = r.origin();
+  vec3 dir = r.direction();
+  vec3 inv_dir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+  bool dir_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+  float s = 0.0f;
+
+  int stack[MAX_DEPTH];
+  int stack_size = 0;
+  int current = MOVING ? segment_root(r.time(), s) : 0;
+  uint64_t box_tests = 0;
+  while (true)
+    {
+      const bvh_node& node = nodes[current];
+      box_tests++;
+      if (MOVING ? hit_interpolated(node.box, end_boxes[current], s, origin, inv_dir, t_min, closest_so_far)
+	  : node.box.hit(origin, inv_dir, t_min, closest_so_far))
+	{
+	  if (node.count > 0)
+	    {
+	      for (int i = 0; i < node.count; ++i)
+		{
+		  if (hit_primitive(prims[node.offset + i], r, t_min, closest_so_far, rec))
+		    {
+		      hit_anything = true;
+		      closest_so_far = rec.t;
+		    }
+		}
+	      if (stack_size == 0)
+		break;
+	      current = stack[--stack_size];
+	    }
+	  else if (dir_neg[node.axis])
+	    {
+	      // Ray travels towards the second child first
+	      stack[stack_size++] = current + 1;
+	      current = node.offset;
+	    }
+	  else
+	    {
+	      stack[stack_size++] = node.offset;
+	      current = current + 1;
+	    }
+	}
+      else
+	{
+	  if (stack_size == 0)
+	    break;
+	  current = stack[--stack_size];
+	}
+    }
+  local_stats().box_tests += box_tests;
+  return hit_anything;
+}
+
+template <bool MOVING>
+bool bvh::any_hit(const ray& r, float t_min, float t_max) const
+{
+  const hitable *before = LAST_OCCLUDER;
+  for (size_t i = 0; i < unbounded.size(); ++i)
+    {
+      if (occluded_primitive(unbounded[i], r, t_min, t_max))
+	{
+	  note_occluder(before, unbounded[i]);
+	  return true;
+	}
+    }
+  if (nodes.empty())
+    return false;
+
+  vec3 origin = r.origin();
+  vec3 dir = r.direction();
+  vec3 inv_dir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+  bool dir_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+  float s = 0.0f;
+
+  int stack[MAX_DEPTH];
+  int stack_size = 0;
+  int current = MOVING ? segment_root(r.time(), s) : 0;
+  uint64_t box_tests = 0;
+  bool blocked = false;
+  while (!blocked)
+    {
+      const bvh_node& node = nodes[current];
+      box_tests++;
+      if (MOVING ? hit_interpolated(node.box, end_boxes[current], s, origin, inv_dir, t_min, t_max)
+	  : node.box.hit(origin, inv_dir, t_min, t_max))
+	{
+	  if (node.count > 0)
+	    {
+	      for (int i = 0; i < node.count && !blocked; ++i)
+		{
+		  if (occluded_primitive(prims[node.offset + i], r, t_min, t_max))
+		    {
+		      note_occluder(before, prims[node.offset + i]);
+		      blocked = true;
+		    }
+		}
+	      if (stack_size == 0)
+		break;
+	      current = stack[--stack_size];
+	    }
+	  else if (dir_neg[node.axis])
+	    {
+	      stack[stack_size++] = current + 1;
+	      current = node.offset;
+	    }
+	  else
+	    {
+	      stack[stack_size++] = node.offset;
+	      current = current + 1;
+	    }
+	}
+      else
+	{
+	  if (stack_size == 0)
+	    break;
+	  current = stack[--stack_size];
+	}
+    }
+  local_stats().box_tests += box_tests;
+  return blocked;
+}
+
+bool bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+  return end_boxes.empty() ? closest_hit<false>(r, t_min, t_max, rec) : closest_hit<true>(r, t_min, t_max, rec);
+}
+
+/* Packet traversal: a node is entered when any lane's ray hits its box before
+   that lane's closest hit, so the whole packet skips a subtree as soon as every
+   lane has missed it. Children are ordered by the direction of the first ray,
+   which is good enough for coherent camera rays. In a moving tree every lane
+   interpolates the node box to its own time, and a tree cut into several
+   segments traces the lanes one by one, since they may need different trees. */
+void bvh::hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const
+{
+  if (segments > 1)
+    {
+      hitable::hit_packet(rp, t_min, hits);
+      return;
+    }
+  for (size_t i = 0; i < unbounded.size(); ++i)
+    unbounded[i]->hit_packet(rp, t_min, hits);
+  if (nodes.empty())
+    return;
+
+  bool dir_neg[3] = { rp.idx[0] < 0, rp.idy[0] < 0, rp.idz[0] < 0 };
+  const vfloat tmin(t_min);
+  const bool moving = !end_boxes.empty();
+  alignas(32) float lane_s[MAX_PACKET];
+  if (moving)
+    for (int i = 0; i < MAX_PACKET; ++i)
+      lane_s[i] = shutter(rp.time[i]);
+
+  int stack[MAX_DEPTH];
+  int stack_size = 0;
+  int current = 0;
+  uint64_t box_tests = 0;
+  while (true)
+    {
+      const bvh_node& node = nodes[current];
+      box_tests++;
+
+      bool entered = false;
+      const vec3 lo = node.box._min, hi = node.box._max;
+      const vec3 dlo = moving ? end_boxes[current]._min - lo : vec3(0.0f, 0.0f, 0.0f);
+      const vec3 dhi = moving ? end_boxes[current]._max - hi : vec3(0.0f, 0.0f, 0.0f);
+      for (int k = 0; k < rp.size && !entered; k += SIMD_WIDTH)
+	{
+	  vfloat bx0(lo.x()), by0(lo.y()), bz0(lo.z());
+	  vfloat bx1(hi.x()), by1(hi.y()), bz1(hi.z());
+	  if (moving)
+	    {
+	      vfloat s = vfloat::load(lane_s + k);
+	      bx0 = bx0 + s*vfloat(dlo.x()); by0 = by0 + s*vfloat(dlo.y()); bz0 = bz0 + s*vfloat(dlo.z());
+	      bx1 = bx1 + s*vfloat(dhi.x()); by1 = by1 + s*vfloat(dhi.y()); bz1 = bz1 + s*vfloat(dhi.z());
+	    }
+	  vfloat ox = vfloat::load(rp.ox + k), oy = vfloat::load(rp.oy + k), oz = vfloat::load(rp.oz + k);
+	  vfloat ix = vfloat::load(rp.idx + k), iy = vfloat::load(rp.idy + k), iz = vfloat::load(rp.idz + k);
+	  vfloat tx0 = (bx0 - ox) * ix, tx1 = (bx1 - ox) * ix;
+	  vfloat ty0 = (by0 - oy) * iy, ty1 = (by1 - oy) * iy;
+	  vfloat tz0 = (bz0 - oz) * iz, tz1 = (bz1 - oz) * iz;
+	  vfloat t_near = vmax(vmin(tx0, tx1), vmax(vmin(ty0, ty1), vmax(vmin(tz0, tz1), tmin)));
+	  vfloat t_far = vmin(vmax(tx0, tx1), vmin(vmax(ty0, ty1), vmin(vmax(tz0, tz1), vfloat::load(hits.t + k))));
+	  entered = any(t_near <= t_far);
+	}
+
+      if (entered && node.count > 0)
+	{
+	  for (int i = 0; i < node.count; ++i)
+	    prims[node.offset + i]->hit_packet(rp, t_min, hits);
+	}
+      else if (entered)
+	{
+	  if (dir_neg[node.axis])
+	    {
+	      stack[stack_size++] = current + 1;
+	      current = node.offset;
+	    }
+	  else
+	    {
+	      stack[stack_size++] = node.offset;
+	      current = current + 1;
+	    }
+	  continue;
+	}
+
+      if (stack_size == 0)
+	break;
+      current = stack[--stack_size];
+    }
+  local_stats().box_tests += box_tests;
+}
+
+// Any hit traversal, stops at the first primitive that blocks the ray
+bool bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+  return end_boxes.empty() ? any_hit<false>(r, t_min, t_max) : any_hit<true>(r, t_min, t_max);
+}
+
+bool bvh::bounding_box(float t0, float t1, aabb& box) const
+{
+  if (!unbounded.empty() || nodes.empty())
+    return false;
+  box = aabb();
+  for (size_t k = 0; k < roots.size(); ++k)
+    {
+      box.expand(nodes[roots[k]].box);
+      if (!end_boxes.empty())
+	box.expand(end_boxes[roots[k]]);
+    }
+  return true;
+}
+
+bool bvh::motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const
+{
+  // A tree built for another interval can only offer its whole sweep
+  if (t0 != time0 || t1 != time1 || end_boxes.empty())
+    return hitable::motion_bounds(t0, t1, box0, box1);
+  if (!unbounded.empty() || nodes.empty())
+    return false;
+  box0 = nodes[roots.front()].box;
+  box1 = end_boxes[roots.back()];
+  return true;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define CAMERA_H
 
 #include "ray.h"
+#include "random.h"
 # define M_PI  3.14159265358979323846  /* pi */
 
 vec3 random_in_unit_disk()
@@ -9,7 +10,7 @@ vec3 random_in_unit_disk()
   vec3 p;  
   do
     {
-      p = ( 2 * vec3(drand48(), drand48(), 0.0) ) - vec3(1.0, 1.0, 0.0);      
+      p = ( 2 * vec3(random_float(), random_float(), 0.0) ) - vec3(1.0, 1.0, 0.0);      
     } while (dot(p, p) >= 1.0);
   return p;
 }
@@ -37,7 +38,7 @@ class camera
   ray get_ray(float s, float t)  {
     vec3 rd = lens_radius * random_in_unit_disk();
     vec3 offset = u * rd.x() + v * rd.y();
-    float time = time0 + drand48()*(time1-time0);
+    float time = time0 + random_float()*(time1-time0);
     return ray(origin + offset, lower_left_corner + s*horizontal + t*vertical - origin - offset, time);
   }
  
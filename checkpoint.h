@@ -0,0 +1,222 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "framebuffer.h"
+#include "render_settings.h"
+#include "tile_scheduler.h"
+
+/* Render checkpoints. A checkpoint holds the linear mean, sample count,
+   luminance variance and denoiser features of every pixel, which is all a
+   later run needs to keep adding samples where an earlier one stopped. The
+   file starts with the image size, scene and every setting that changes the
+   samples (see sample_fingerprint()), so samples of different renders never
+   get mixed up. Files are written next to their final name and then renamed
+   over it, so a process killed halfway through writing leaves the last
+   checkpoint intact. */
+
+const char CHECKPOINT_MAGIC[8] = { 'R', 'F', 'C', 'K', 'P', 'T', '0', '3' };
+
+// What a checkpoint must match to be resumed
+struct checkpoint_info
+{
+  std::string scene;
+  int mode;
+  std::string settings;  // sample_fingerprint() of the render
+};
+
+bool save_checkpoint(const std::string& file_name, const framebuffer& fb, const checkpoint_info& info)
+{
+  std::string temp_name = file_name + ".tmp";
+  {
+    std::ofstream out(temp_name.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out)
+      {
+	std::cerr << "Cannot write checkpoint " << temp_name << std::endl;
+	return false;
+      }
+    int32_t header[5] = { fb.width, fb.height, info.mode, (int32_t)info.scene.size(), (int32_t)info.settings.size() };
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    out.write((const char *)header, sizeof(header));
+    out.write(info.scene.data(), info.scene.size());
+    out.write(info.settings.data(), info.settings.size());
+    size_t n = fb.pixels.size();
+    out.write((const char *)&fb.pixels[0], n * sizeof(vec3));
+    out.write((const char *)&fb.sample_count[0], n * sizeof(int));
+    out.write((const char *)&fb.luminance_m2[0], n * sizeof(float));
+    out.write((const char *)&fb.albedo[0], n * sizeof(vec3));
+    out.write((const char *)&fb.normal[0], n * sizeof(vec3));
+    out.write((const char *)&fb.depth[0], n * sizeof(float));
+    if (!out.flush())
+      {
+	std::cerr << "Cannot write checkpoint " << temp_name << std::endl;
+	return false;
+      }
+  }
+  // Windows will not rename over an existing file
+  if (rename(temp_name.c_str(), file_name.c_str()) != 0)
+    {
+      remove(file_name.c_str());
+      if (rename(temp_name.c_str(), file_name.c_str()) != 0)
+	{
+	  std::cerr << "Cannot replace checkpoint " << file_name << std::endl;
+	  return false;
+	}
+    }
+  return true;
+}
+
+bool checkpoint_exists(const std::string& file_name)
+{
+  std::ifstream in(file_name.c_str(), std::ios::binary);
+  return in.good();
+}
+
+// Fills fb with the checkpointed pixels, returns false if the file is unreadable or from another render
+bool load_checkpoint(const std::string& file_name, framebuffer& fb, const checkpoint_info& info)
+{
+  std::ifstream in(file_name.c_str(), std::ios::binary);
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  int32_t header[5];
+  if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC) ||
+      !in.read((char *)header, sizeof(header)) || header[3] < 0 || header[3] > 4096 || header[4] < 0 || header[4] > 4096)
+    {
+      std::cerr << file_name << " is not a checkpoint" << std::endl;
+      return false;
+    }
+  std::string scene(header[3], '\0');
+  std::string settings(header[4], '\0');
+  in.read(&scene[0], scene.size());
+  in.read(&settings[0], settings.size());
+  if (header[0] != fb.width || header[1] != fb.height || header[2] != info.mode || scene != info.scene)
+    {
+      std::cerr << file_name << " was saved by another render (" << scene << " at " << header[0] << " x " << header[1]
+		<< "), cannot resume it" << std::endl;
+      return false;
+    }
+  if (settings != info.settings)
+    {
+      std::cerr << file_name << " was saved with other settings (" << settings << "), cannot resume it" << std::endl;
+      return false;
+    }
+  size_t n = fb.pixels.size();
+  in.read((char *)&fb.pixels[0], n * sizeof(vec3));
+  in.read((char *)&fb.sample_count[0], n * sizeof(int));
+  in.read((char *)&fb.luminance_m2[0], n * sizeof(float));
+  in.read((char *)&fb.albedo[0], n * sizeof(vec3));
+  in.read((char *)&fb.normal[0], n * sizeof(vec3));
+  in.read((char *)&fb.depth[0], n * sizeof(float));
+  if (!in)
+    {
+      std::cerr << file_name << " is truncated" << std::endl;
+      fb = framebuffer(fb.width, fb.height);
+      return false;
+    }
+  return true;
+}
+
+/* Checkpoints a framebuffer while it is being rendered. Render threads report
+   finished tiles, which are copied into a snapshot, and a background thread
+   writes the snapshot out every interval seconds. Tiles still being rendered
+   keep the values they had when the render started, so every checkpoint is a
+   consistent state to resume from. */
+class checkpoint_writer
+{
+ public:
+  checkpoint_writer(const framebuffer& fb, const checkpoint_info& info, const std::string& file_name, double interval);
+  ~checkpoint_writer();
+
+  // Called by the render threads once every pixel of the tile is in the framebuffer
+  void tile_done(const tile& t);
+  // Stops the background thread and writes the final state
+  void finish();
+
+ private:
+  void writer_loop();
+
+  const framebuffer& fb;
+  checkpoint_info info;
+  std::string file_name;
+  std::chrono::duration<double> interval;
+  framebuffer snapshot;
+  bool changed;   // tiles finished since the last write
+  bool stopping;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::thread thread;
+};
+
+checkpoint_writer::checkpoint_writer(const framebuffer& f, const checkpoint_info& i, const std::string& name, double seconds)
+  : fb(f), info(i), file_name(name), interval(seconds), snapshot(f), changed(false), stopping(false)
+{
+  thread = std::thread(&checkpoint_writer::writer_loop, this);
+}
+
+checkpoint_writer::~checkpoint_writer()
+{
+  finish();
+}
+
+void checkpoint_writer::tile_done(const tile& t)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (int y = t.y0; y < t.y1; ++y)
+    {
+      int begin = y * fb.width + t.x0, end = y * fb.width + t.x1;
+      std::copy(fb.pixels.begin() + begin, fb.pixels.begin() + end, snapshot.pixels.begin() + begin);
+      std::copy(fb.sample_count.begin() + begin, fb.sample_count.begin() + end, snapshot.sample_count.begin() + begin);
+      std::copy(fb.luminance_m2.begin() + begin, fb.luminance_m2.begin() + end, snapshot.luminance_m2.begin() + begin);
+      std::copy(fb.albedo.begin() + begin, fb.albedo.begin() + end, snapshot.albedo.begin() + begin);
+      std::copy(fb.normal.begin() + begin, fb.normal.begin() + end, snapshot.normal.begin() + begin);
+      std::copy(fb.depth.begin() + begin, fb.depth.begin() + end, snapshot.depth.begin() + begin);
+    }
+  changed = true;
+}
+
+void checkpoint_writer::finish()
+{
+  if (!thread.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void checkpoint_writer::writer_loop()
+{
+  framebuffer copy;
+  while (true)
+    {
+      bool last;
+      {
+	std::unique_lock<std::mutex> guard(lock);
+	wake.wait_for(guard, interval, [&]() { return stopping; });
+	last = stopping;
+	if (!changed)
+	  {
+	    if (last)
+	      return;
+	    continue;
+	  }
+	// Write from a copy so the render threads are not held up by the disk
+	copy = snapshot;
+	changed = false;
+      }
+      save_checkpoint(file_name, copy, info);
+      if (last)
+	return;
+    }
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "framebuffer.h"
+#include "tile_scheduler.h"
+
+/* Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) with the
+   variance guided luminance weight of SVGF (Schied et al. 2017). The image is
+   divided by the first hit albedo, so textures stay out of the blur and are
+   multiplied back in at the end. The remaining illumination is smoothed with a
+   5x5 B3 spline kernel whose taps are 1, 2, 4 ... pixels apart in successive
+   passes. Every tap is weighted down by how far its normal, depth and
+   luminance are from those of the centre pixel, the luminance relative to the
+   centre's own noise, so noise is blurred away but edges and shadows stay.
+   Passes are cut into tiles and run on the tile scheduler. */
+
+const float DENOISE_SIGMA_NORMAL = 128.0f;    // exponent on the cosine between normals
+const float DENOISE_SIGMA_DEPTH = 1.0f;       // depth difference allowed per pixel of depth gradient
+const float DENOISE_SIGMA_LUMINANCE = 4.0f;   // luminance difference allowed per standard deviation of noise
+const float DENOISE_ALBEDO_BIAS = 0.01f;      // added before the albedo is divided out, keeps black surfaces finite
+
+class denoiser
+{
+ public:
+  denoiser(const framebuffer& noisy, int threads);
+  // The noisy frame filtered by the given number of passes
+  framebuffer run(int passes);
+
+ private:
+  void filter_pass(const tile& t, int step);
+
+  const framebuffer& fb;
+  int threads;
+  int width, height;
+  std::vector<vec3> color[2];
+  std::vector<float> variance[2];  // of the mean luminance of every pixel
+  std::vector<float> gradient;     // of the depth, per pixel
+  int current;                     // buffers the next pass reads
+};
+
+denoiser::denoiser(const framebuffer& noisy, int n)
+  : fb(noisy), threads(n), width(noisy.width), height(noisy.height), gradient(noisy.width * noisy.height), current(0)
+{
+  int size = width * height;
+  const vec3 bias(DENOISE_ALBEDO_BIAS, DENOISE_ALBEDO_BIAS, DENOISE_ALBEDO_BIAS);
+  for (int b = 0; b < 2; ++b)
+    {
+      color[b].resize(size);
+      variance[b].resize(size);
+    }
+  for (int i = 0; i < size; ++i)
+    {
+      color[0][i] = fb.pixels[i] / (fb.albedo[i] + bias);
+      int samples = fb.sample_count[i];
+      float a = luminance(fb.albedo[i]) + DENOISE_ALBEDO_BIAS;
+      variance[0][i] = samples > 1 ? fb.luminance_m2[i] / ((samples - 1) * float(samples) * a * a) : 0.0f;
+    }
+
+  // The one sided difference towards the flatter neighbour, so silhouettes do not count as steep
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x)
+      {
+	const float *d = &fb.depth[y * width + x];
+	float dx = std::min(x > 0 ? fabsf(d[0] - d[-1]) : FLT_MAX, x + 1 < width ? fabsf(d[1] - d[0]) : FLT_MAX);
+	float dy = std::min(y > 0 ? fabsf(d[0] - d[-width]) : FLT_MAX, y + 1 < height ? fabsf(d[width] - d[0]) : FLT_MAX);
+	gradient[y * width + x] = std::max(dx < FLT_MAX ? dx : 0.0f, dy < FLT_MAX ? dy : 0.0f);
+      }
+}
+
+void denoiser::filter_pass(const tile& t, int step)
+{
+  static const float KERNEL[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+  const std::vector<vec3>& in = color[current];
+  const std::vector<float>& in_var = variance[current];
+  std::vector<vec3>& out = color[1 - current];
+  std::vector<float>& out_var = variance[1 - current];
+
+  for (int y = t.y0; y < t.y1; ++y)
+    for (int x = t.x0; x < t.x1; ++x)
+      {
+	const int p = y * width + x;
+	const vec3& np = fb.normal[p];
+	const float zp = fb.depth[p];
+	const float lp = luminance(in[p]);
+
+	// The noise estimate of a single pixel is itself noisy, so it is taken from a 3x3 blur
+	float blurred = 0.0f, blur_weight = 0.0f;
+	for (int dy = -1; dy <= 1; ++dy)
+	  for (int dx = -1; dx <= 1; ++dx)
+	    {
+	      int qx = x + dx, qy = y + dy;
+	      if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+		continue;
+	      float w = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+	      blurred += w * in_var[qy * width + qx];
+	      blur_weight += w;
+	    }
+	const float luminance_scale = DENOISE_SIGMA_LUMINANCE * sqrtf(std::max(blurred / blur_weight, 0.0f)) + 1e-4f;
+	const float depth_scale = DENOISE_SIGMA_DEPTH * gradient[p] * step;
+
+	vec3 sum(0.0f, 0.0f, 0.0f);
+	float sum_weight = 0.0f, sum_var = 0.0f;
+	for (int dy = -2; dy <= 2; ++dy)
+	  for (int dx = -2; dx <= 2; ++dx)
+	    {
+	      int qx = x + dx * step, qy = y + dy * step;
+	      if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+		continue;
+	      const int q = qy * width + qx;
+
+	      // cos^128 by squaring seven times
+	      float wn = std::max(dot(np, fb.normal[q]), 0.0f);
+	      for (int k = 0; k < 7; ++k)
+		wn *= wn;
+	      float distance = sqrtf(float(dx * dx + dy * dy));
+	      float wz = fabsf(zp - fb.depth[q]) / (depth_scale * distance + 1e-3f * zp + 1e-6f);
+	      float wl = fabsf(lp - luminance(in[q])) / luminance_scale;
+	      float w = KERNEL[dx < 0 ? -dx : dx] * KERNEL[dy < 0 ? -dy : dy] * wn * expf(-wz - wl);
+
+	      sum += w * in[q];
+	      sum_weight += w;
+	      sum_var += w * w * in_var[q];
+	    }
+	// The centre tap always has a weight, unless its normal is 0
+	if (sum_weight > 0.0f)
+	  {
+	    out[p] = sum / sum_weight;
+	    out_var[p] = sum_var / (sum_weight * sum_weight);
+	  }
+	else
+	  {
+	    out[p] = in[p];
+	    out_var[p] = in_var[p];
+	  }
+      }
+}
+
+framebuffer denoiser::run(int passes)
+{
+  for (int pass = 0; pass < passes; ++pass)
+    {
+      int step = 1 << pass;
+      tile_scheduler scheduler(width, height, 32, threads);
+      scheduler.run([&](const tile& t) { filter_pass(t, step); }, [](double) {});
+      current = 1 - current;
+    }
+
+  framebuffer result = fb;
+  const vec3 bias(DENOISE_ALBEDO_BIAS, DENOISE_ALBEDO_BIAS, DENOISE_ALBEDO_BIAS);
+  for (int i = 0; i < width * height; ++i)
+    result.pixels[i] = color[current][i] * (fb.albedo[i] + bias);
+  return result;
+}
+
+// Convenience for a denoiser used once
+framebuffer denoise(const framebuffer& noisy, int passes, int threads)
+{
+  denoiser d(noisy, threads);
+  return d.run(passes);
+}
+
+#endif
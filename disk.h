@@ -12,6 +12,7 @@ class disk : public hitable
  disk(vec3 cen, float w, float h, vec3 n, material *m) : center(cen), width(w), height(h), norm(n), mat_ptr(m) {};
   
   virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const { return false; }
 
   vec3 center;
   vec3 norm;
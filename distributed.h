@@ -0,0 +1,669 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "framebuffer.h"
+#include "render_settings.h"
+#include "render_stats.h"
+#include "tile_scheduler.h"
+
+/* Rendering a frame across processes. A coordinator splits the frame into
+   tiles and hands them to worker processes, either ones it forked itself and
+   talks to over a socket pair, or ones on other machines that connect over
+   TCP. Workers build the same scene from the same settings and seed, so a
+   tile comes back with the same pixels whichever worker rendered it, and the
+   coordinator merges the float tiles into its framebuffer.
+
+   Every tile request carries the tile's current pixels, sample counts,
+   variances and denoiser features and every reply the finished ones, so
+   workers keep no state between tiles and resumed checkpoints work the same
+   as in one process. Workers that disconnect have their tiles put back in the
+   queue, and once the queue is empty the tiles that have been out the longest
+   are handed to a second worker, so a slow or hung machine cannot hold up the
+   end of the frame. Whichever copy of a tile arrives first is kept.
+
+   Messages are sent in the byte order of the machine, so every process must
+   run on the same architecture. */
+
+const uint32_t WORKER_MAGIC = 0x52465732;  // RFW2, bumped whenever the tile layout changes
+
+// Everything that changes the pixels, which must be the same for the coordinator and its workers
+std::string render_fingerprint(const render_settings& s)
+{
+  std::ostringstream out;
+  out << s.scene << " " << s.width << "x" << s.height << " " << sample_fingerprint(s) << " samples " << s.samples;
+  return out.str();
+}
+
+bool send_all(int fd, const void *data, size_t size)
+{
+  const char *p = (const char *)data;
+  while (size > 0)
+    {
+      ssize_t n = write(fd, p, size);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+bool recv_all(int fd, void *data, size_t size)
+{
+  char *p = (char *)data;
+  while (size > 0)
+    {
+      ssize_t n = read(fd, p, size);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+// Starts every message after the hello. An index of -1 ends the render, the
+// worker answers it with its statistics
+struct tile_message
+{
+  int32_t index;
+  int32_t x0, y0, x1, y1;
+};
+
+const size_t TILE_PIXEL_BYTES = 3 * sizeof(vec3) + sizeof(int) + 2 * sizeof(float);
+
+// Appends the header followed by the pixels, sample counts, variances and features of the tile
+void pack_tile(int index, const tile& t, const framebuffer& fb, std::vector<char>& buffer)
+{
+  tile_message m = { index, t.x0, t.y0, t.x1, t.y1 };
+  int w = t.x1 - t.x0;
+  size_t start = buffer.size();
+  buffer.resize(start + sizeof(m) + w * (t.y1 - t.y0) * TILE_PIXEL_BYTES);
+  char *p = &buffer[start];
+  memcpy(p, &m, sizeof(m));
+  p += sizeof(m);
+  for (int y = t.y0; y < t.y1; ++y)
+    {
+      int i = y * fb.width + t.x0;
+      memcpy(p, &fb.pixels[i], w * sizeof(vec3));
+      p += w * sizeof(vec3);
+      memcpy(p, &fb.sample_count[i], w * sizeof(int));
+      p += w * sizeof(int);
+      memcpy(p, &fb.luminance_m2[i], w * sizeof(float));
+      p += w * sizeof(float);
+      memcpy(p, &fb.albedo[i], w * sizeof(vec3));
+      p += w * sizeof(vec3);
+      memcpy(p, &fb.normal[i], w * sizeof(vec3));
+      p += w * sizeof(vec3);
+      memcpy(p, &fb.depth[i], w * sizeof(float));
+      p += w * sizeof(float);
+    }
+}
+
+bool send_tile(int fd, int index, const tile& t, const framebuffer& fb, std::vector<char>& buffer)
+{
+  buffer.clear();
+  pack_tile(index, t, fb, buffer);
+  return send_all(fd, &buffer[0], buffer.size());
+}
+
+// Reads the tile after a header into the buffer, returns false on a broken connection or a tile outside the frame
+bool recv_tile(int fd, const tile_message& m, int width, int height, tile& t, std::vector<char>& buffer)
+{
+  if (m.x0 < 0 || m.y0 < 0 || m.x1 > width || m.y1 > height || m.x0 >= m.x1 || m.y0 >= m.y1)
+    return false;
+  t.x0 = m.x0;
+  t.y0 = m.y0;
+  t.x1 = m.x1;
+  t.y1 = m.y1;
+  buffer.resize((t.x1 - t.x0) * (t.y1 - t.y0) * TILE_PIXEL_BYTES);
+  return recv_all(fd, &buffer[0], buffer.size());
+}
+
+void unpack_tile(const std::vector<char>& buffer, const tile& t, framebuffer& fb)
+{
+  const char *p = &buffer[0];
+  int w = t.x1 - t.x0;
+  for (int y = t.y0; y < t.y1; ++y)
+    {
+      int i = y * fb.width + t.x0;
+      memcpy(&fb.pixels[i], p, w * sizeof(vec3));
+      p += w * sizeof(vec3);
+      memcpy(&fb.sample_count[i], p, w * sizeof(int));
+      p += w * sizeof(int);
+      memcpy(&fb.luminance_m2[i], p, w * sizeof(float));
+      p += w * sizeof(float);
+      memcpy(&fb.albedo[i], p, w * sizeof(vec3));
+      p += w * sizeof(vec3);
+      memcpy(&fb.normal[i], p, w * sizeof(vec3));
+      p += w * sizeof(vec3);
+      memcpy(&fb.depth[i], p, w * sizeof(float));
+      p += w * sizeof(float);
+    }
+}
+
+// Connects a worker started with --connect HOST:PORT, returns -1 on failure
+int connect_to_coordinator(const std::string& address)
+{
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos)
+    {
+      std::cerr << "Expected HOST:PORT, got " << address << std::endl;
+      return -1;
+    }
+  std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+  addrinfo hints, *found;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+    {
+      std::cerr << "Cannot resolve " << address << std::endl;
+      return -1;
+    }
+  int fd = -1;
+  for (addrinfo *a = found; a && fd < 0; a = a->ai_next)
+    {
+      fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+	{
+	  close(fd);
+	  fd = -1;
+	}
+    }
+  freeaddrinfo(found);
+  if (fd < 0)
+    std::cerr << "Cannot connect to " << address << std::endl;
+  return fd;
+}
+
+/* Worker side. Introduces itself with the number of tiles it can render at
+   once, then every render thread takes the next request off the connection,
+   traces it into the worker's framebuffer with render_tile(const tile&) and
+   sends it back. Returns false if the coordinator went away mid render. */
+template <typename F>
+bool run_worker(int fd, int threads, const std::string& fingerprint, framebuffer& fb, F render_tile)
+{
+  signal(SIGPIPE, SIG_IGN);
+  int32_t hello[3] = { (int32_t)WORKER_MAGIC, threads, (int32_t)fingerprint.size() };
+  if (!send_all(fd, hello, sizeof(hello)) || !send_all(fd, fingerprint.data(), fingerprint.size()))
+    return false;
+
+  std::mutex in_lock, out_lock;
+  std::atomic<bool> stopped(false), failed(false);
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; ++i)
+    {
+      pool.push_back(std::thread([&]() {
+	    std::vector<char> buffer;
+	    while (true)
+	      {
+		tile_message m;
+		tile t;
+		{
+		  std::lock_guard<std::mutex> guard(in_lock);
+		  if (stopped)
+		    return;
+		  if (!recv_all(fd, &m, sizeof(m)))
+		    {
+		      failed = stopped = true;
+		      return;
+		    }
+		  if (m.index < 0)
+		    {
+		      stopped = true;
+		      return;
+		    }
+		  if (!recv_tile(fd, m, fb.width, fb.height, t, buffer))
+		    {
+		      failed = stopped = true;
+		      return;
+		    }
+		  unpack_tile(buffer, t, fb);
+		}
+		render_tile(t);
+		std::lock_guard<std::mutex> guard(out_lock);
+		if (!send_tile(fd, m.index, t, fb, buffer))
+		  {
+		    failed = stopped = true;
+		    return;
+		  }
+	      }
+	  }));
+    }
+  for (size_t i = 0; i < pool.size(); ++i)
+    pool[i].join();
+  if (failed)
+    return false;
+
+  tile_message end = { -1, 0, 0, 0, 0 };
+  thread_stats stats = STATS.merged();
+  return send_all(fd, &end, sizeof(end)) && send_all(fd, &stats, sizeof(stats));
+}
+
+/* Coordinator side, see the top of the file. Workers are added with
+   spawn_workers() and listen_on() before run() hands out the tiles. */
+class tile_coordinator
+{
+ public:
+  tile_coordinator(const std::vector<tile>& tiles, framebuffer& fb, const std::string& fingerprint);
+  ~tile_coordinator();
+
+  // Forks count copies of this program, args is the command line to run them with
+  bool spawn_workers(int count, const std::vector<std::string>& args);
+  // Accepts workers started elsewhere with --connect while the frame renders
+  bool listen_on(int port);
+
+  /* Blocks until every tile is back in the framebuffer, calling done(const tile&)
+     for each as it lands and report(double) with the fraction completed. If
+     every worker is lost the remaining tiles are passed to done() unrendered,
+     so the partial frame still gets written, and false is returned. */
+  template <typename D, typename P>
+    bool run(D done, P report);
+
+  // Render threads of every worker that joined the render
+  int thread_count() const { return total_threads; }
+
+ private:
+  struct worker
+  {
+    int fd;
+    pid_t pid;          // 0 for workers that connected over TCP
+    int capacity;       // tiles in flight at once, 0 until the hello is read
+    std::vector<int> tiles;
+    std::vector<char> out;  // messages not yet taken by the socket
+    size_t sent;            // bytes of out already written
+  };
+
+  bool greet(worker& w);
+  bool receive(worker& w, int& landed);
+  bool fill(worker& w);
+  bool flush(worker& w);
+  void watch(std::vector<pollfd>& polled) const;
+  int next_tile(const worker& w);
+  void drop(size_t i, bool kill_process);
+  void shutdown();
+
+  std::vector<tile> tiles;
+  framebuffer& fb;
+  std::string fingerprint;
+  std::vector<worker> workers;
+  std::deque<int> pending;
+  std::vector<bool> finished;
+  std::vector<int> holders;   // workers currently rendering each tile
+  std::vector<std::chrono::steady_clock::time_point> issued;
+  int remaining;
+  int listen_fd;
+  int total_threads;
+  std::vector<char> buffer;
+};
+
+tile_coordinator::tile_coordinator(const std::vector<tile>& t, framebuffer& f, const std::string& fp)
+  : tiles(t), fb(f), fingerprint(fp), finished(t.size(), false), holders(t.size(), 0), issued(t.size()),
+    remaining((int)t.size()), listen_fd(-1), total_threads(0)
+{
+  signal(SIGPIPE, SIG_IGN);
+  for (size_t i = 0; i < tiles.size(); ++i)
+    pending.push_back((int)i);
+}
+
+tile_coordinator::~tile_coordinator()
+{
+  while (!workers.empty())
+    drop(workers.size() - 1, true);
+  if (listen_fd >= 0)
+    close(listen_fd);
+}
+
+bool tile_coordinator::spawn_workers(int count, const std::vector<std::string>& args)
+{
+  for (int i = 0; i < count; ++i)
+    {
+      int fds[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+	{
+	  perror("socketpair");
+	  return false;
+	}
+      fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+      // Everything the child needs is built before the fork, only exec runs after it
+      std::vector<std::string> child_args(args);
+      child_args.push_back("--worker-fd");
+      child_args.push_back(std::to_string(fds[1]));
+      std::vector<char*> argv;
+      for (size_t k = 0; k < child_args.size(); ++k)
+	argv.push_back(&child_args[k][0]);
+      argv.push_back(nullptr);
+
+      pid_t pid = fork();
+      if (pid == 0)
+	{
+	  execvp(argv[0], &argv[0]);
+	  _exit(127);
+	}
+      close(fds[1]);
+      if (pid < 0)
+	{
+	  perror("fork");
+	  close(fds[0]);
+	  return false;
+	}
+      worker w = { fds[0], pid, 0, std::vector<int>(), std::vector<char>(), 0 };
+      workers.push_back(w);
+    }
+  return true;
+}
+
+bool tile_coordinator::listen_on(int port)
+{
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons((uint16_t)port);
+  if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 16) != 0)
+    {
+      perror("listen");
+      if (listen_fd >= 0)
+	close(listen_fd);
+      listen_fd = -1;
+      return false;
+    }
+  fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+  return true;
+}
+
+// Workers that render another scene or with other settings are turned away
+bool tile_coordinator::greet(worker& w)
+{
+  int32_t hello[3];
+  if (!recv_all(w.fd, hello, sizeof(hello)) || hello[0] != (int32_t)WORKER_MAGIC || hello[1] <= 0 || hello[2] < 0 || hello[2] > 4096)
+    return false;
+  std::string theirs(hello[2], '\0');
+  if (!recv_all(w.fd, &theirs[0], theirs.size()))
+    return false;
+  if (theirs != fingerprint)
+    {
+      std::cerr << "Rejected a worker rendering " << theirs << std::endl;
+      return false;
+    }
+  // One tile more than it has threads, so a thread never waits on the round trip
+  w.capacity = hello[1] + 1;
+  total_threads += hello[1];
+  return true;
+}
+
+int tile_coordinator::next_tile(const worker& w)
+{
+  while (!pending.empty())
+    {
+      int index = pending.front();
+      pending.pop_front();
+      if (!finished[index])
+	return index;
+    }
+  // Nothing left to hand out, back up the tile that has been out the longest
+  int best = -1;
+  for (size_t i = 0; i < workers.size(); ++i)
+    {
+      for (size_t k = 0; k < workers[i].tiles.size(); ++k)
+	{
+	  int index = workers[i].tiles[k];
+	  if (finished[index] || holders[index] > 1 || std::find(w.tiles.begin(), w.tiles.end(), index) != w.tiles.end())
+	    continue;
+	  if (best < 0 || issued[index] < issued[best])
+	    best = index;
+	}
+    }
+  return best;
+}
+
+bool tile_coordinator::fill(worker& w)
+{
+  while ((int)w.tiles.size() < w.capacity)
+    {
+      int index = next_tile(w);
+      if (index < 0)
+	break;
+      w.tiles.push_back(index);
+      holders[index]++;
+      if (holders[index] == 1)
+	issued[index] = std::chrono::steady_clock::now();
+      pack_tile(index, tiles[index], fb, w.out);
+    }
+  return flush(w);
+}
+
+/* Writes as much of the worker's queue as the socket takes without blocking.
+   A worker thread blocked sending a reply reads no requests, so a coordinator
+   blocked sending it a request would wait forever; the rest is written once
+   poll() reports room. Returns false on a broken connection. */
+bool tile_coordinator::flush(worker& w)
+{
+  while (w.sent < w.out.size())
+    {
+      ssize_t n = send(w.fd, &w.out[w.sent], w.out.size() - w.sent, MSG_DONTWAIT);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	return true;
+      if (n <= 0)
+	return false;
+      w.sent += n;
+    }
+  w.out.clear();
+  w.sent = 0;
+  return true;
+}
+
+// Replies are waited for from every worker, room to write only where messages are queued
+void tile_coordinator::watch(std::vector<pollfd>& polled) const
+{
+  polled.clear();
+  for (size_t i = 0; i < workers.size(); ++i)
+    {
+      pollfd p = { workers[i].fd, short(POLLIN | (workers[i].sent < workers[i].out.size() ? POLLOUT : 0)), 0 };
+      polled.push_back(p);
+    }
+}
+
+// landed is the index of the tile if this was the first copy of it to arrive, -1 otherwise
+bool tile_coordinator::receive(worker& w, int& landed)
+{
+  landed = -1;
+  tile_message m;
+  tile t;
+  if (!recv_all(w.fd, &m, sizeof(m)) || m.index < 0 || m.index >= (int)tiles.size())
+    return false;
+  std::vector<int>::iterator held = std::find(w.tiles.begin(), w.tiles.end(), m.index);
+  if (held == w.tiles.end() || !recv_tile(w.fd, m, fb.width, fb.height, t, buffer))
+    return false;
+  w.tiles.erase(held);
+  holders[m.index]--;
+  // The slower copy of a backed up tile is dropped
+  if (!finished[m.index])
+    {
+      unpack_tile(buffer, t, fb);
+      finished[m.index] = true;
+      remaining--;
+      landed = m.index;
+    }
+  return true;
+}
+
+// Closes the connection and puts the worker's unfinished tiles back at the front of the queue
+void tile_coordinator::drop(size_t i, bool kill_process)
+{
+  worker& w = workers[i];
+  close(w.fd);
+  if (w.pid > 0)
+    {
+      if (kill_process)
+	kill(w.pid, SIGKILL);
+      waitpid(w.pid, nullptr, 0);
+    }
+  for (size_t k = 0; k < w.tiles.size(); ++k)
+    {
+      int index = w.tiles[k];
+      if (--holders[index] == 0 && !finished[index])
+	pending.push_front(index);
+    }
+  workers.erase(workers.begin() + i);
+}
+
+// Ends the render on every worker and merges the statistics they send back
+void tile_coordinator::shutdown()
+{
+  tile_message end = { -1, 0, 0, 0, 0 };
+  for (size_t i = workers.size(); i-- > 0;)
+    {
+      worker& w = workers[i];
+      if (w.capacity > 0)
+	w.out.insert(w.out.end(), (const char *)&end, (const char *)&end + sizeof(end));
+      if (w.capacity == 0 || !flush(w))
+	drop(i, true);
+    }
+
+  // Workers still finishing a backed up tile get a few seconds before they are killed
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  std::vector<pollfd> polled;
+  while (!workers.empty() && std::chrono::steady_clock::now() < deadline)
+    {
+      watch(polled);
+      if (poll(&polled[0], polled.size(), 100) < 0 && errno != EINTR)
+	break;
+      for (size_t i = workers.size(); i-- > 0;)
+	{
+	  if ((polled[i].revents & POLLOUT) && !flush(workers[i]))
+	    {
+	      drop(i, true);
+	      continue;
+	    }
+	  if (!(polled[i].revents & (POLLIN | POLLHUP | POLLERR)))
+	    continue;
+	  tile_message m;
+	  tile t;
+	  thread_stats stats;
+	  if (!recv_all(workers[i].fd, &m, sizeof(m)))
+	    drop(i, true);
+	  else if (m.index >= 0)
+	    {
+	      if (!recv_tile(workers[i].fd, m, fb.width, fb.height, t, buffer))
+		drop(i, true);
+	    }
+	  else
+	    {
+	      if (recv_all(workers[i].fd, &stats, sizeof(stats)))
+		local_stats().merge(stats);
+	      drop(i, false);
+	    }
+	}
+    }
+  while (!workers.empty())
+    drop(workers.size() - 1, true);
+}
+
+template <typename D, typename P>
+bool tile_coordinator::run(D done, P report)
+{
+  std::vector<pollfd> polled;
+  std::chrono::steady_clock::time_point last_report;
+  while (remaining > 0)
+    {
+      if (workers.empty() && listen_fd < 0)
+	{
+	  std::cerr << std::endl << "Every worker is gone, " << remaining << " tiles were not rendered" << std::endl;
+	  for (size_t i = 0; i < tiles.size(); ++i)
+	    if (!finished[i])
+	      done(tiles[i]);
+	  return false;
+	}
+
+      watch(polled);
+      if (listen_fd >= 0)
+	{
+	  pollfd p = { listen_fd, POLLIN, 0 };
+	  polled.push_back(p);
+	}
+      if (poll(&polled[0], polled.size(), 100) < 0 && errno != EINTR)
+	{
+	  perror("poll");
+	  return false;
+	}
+
+      // Backwards, so dropping a worker does not move the ones still to check
+      for (size_t i = workers.size(); i-- > 0;)
+	{
+	  if ((polled[i].revents & POLLOUT) && !flush(workers[i]))
+	    {
+	      drop(i, true);
+	      continue;
+	    }
+	  if (!(polled[i].revents & (POLLIN | POLLHUP | POLLERR)))
+	    continue;
+	  worker& w = workers[i];
+	  int landed = -1;
+	  bool ok = w.capacity == 0 ? greet(w) : receive(w, landed);
+	  if (landed >= 0)
+	    done(tiles[landed]);
+	  if (!ok || !fill(w))
+	    drop(i, true);
+	}
+      if (listen_fd >= 0 && (polled.back().revents & POLLIN))
+	{
+	  int fd = accept(listen_fd, nullptr, nullptr);
+	  if (fd >= 0)
+	    {
+	      fcntl(fd, F_SETFD, FD_CLOEXEC);
+	      worker w = { fd, 0, 0, std::vector<int>(), std::vector<char>(), 0 };
+	      workers.push_back(w);
+	    }
+	}
+      // Tiles freed by dropped workers go to whoever has room
+      for (size_t i = workers.size(); i-- > 0;)
+	if (workers[i].capacity > 0 && !fill(workers[i]))
+	  drop(i, true);
+
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now - last_report > std::chrono::milliseconds(100))
+	{
+	  report(double(tiles.size() - remaining) / tiles.size());
+	  last_report = now;
+	}
+    }
+  report(1.0);
+  shutdown();
+  return true;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <vector>
+#include "vec3.h"
+
+// Linear radiance for every pixel, row 0 is the bottom of the image
+class framebuffer
+{
+ public:
+  framebuffer() : width(0), height(0) {}
+ framebuffer(int w, int h)
+   : width(w), height(h), pixels(w * h, vec3(0.0f, 0.0f, 0.0f)), sample_count(w * h, 0), luminance_m2(w * h, 0.0f),
+    albedo(w * h, vec3(0.0f, 0.0f, 0.0f)), normal(w * h, vec3(0.0f, 0.0f, 0.0f)), depth(w * h, 0.0f) {}
+
+  vec3& at(int x, int y) { return pixels[y * width + x]; }
+  const vec3& at(int x, int y) const { return pixels[y * width + x]; }
+  const vec3 *row(int y) const { return &pixels[y * width]; }
+  int& samples_at(int x, int y) { return sample_count[y * width + x]; }
+  float& m2_at(int x, int y) { return luminance_m2[y * width + x]; }
+  vec3& albedo_at(int x, int y) { return albedo[y * width + x]; }
+  vec3& normal_at(int x, int y) { return normal[y * width + x]; }
+  float& depth_at(int x, int y) { return depth[y * width + x]; }
+
+  double mean_samples() const;
+  framebuffer sample_heatmap() const;
+
+  int width;
+  int height;
+  std::vector<vec3> pixels;
+  std::vector<int> sample_count;  // samples that went into every pixel
+  std::vector<float> luminance_m2;  // sum of squared luminance deviations, lets adaptive sampling resume
+  // Where the camera rays first hit, averaged over the samples like pixels. Guides the denoiser
+  std::vector<vec3> albedo;
+  std::vector<vec3> normal;
+  std::vector<float> depth;
+};
+
+double framebuffer::mean_samples() const
+{
+  double total = 0.0;
+  for (size_t i = 0; i < sample_count.size(); ++i)
+    total += sample_count[i];
+  return sample_count.empty() ? 0.0 : total / sample_count.size();
+}
+
+// Sample counts scaled so the busiest pixel is white, for tuning adaptive sampling
+framebuffer framebuffer::sample_heatmap() const
+{
+  framebuffer heat(width, height);
+  int most = 1;
+  for (size_t i = 0; i < sample_count.size(); ++i)
+    most = std::max(most, sample_count[i]);
+  for (size_t i = 0; i < sample_count.size(); ++i)
+    {
+      float v = float(sample_count[i]) / most;
+      heat.pixels[i] = vec3(v, v, v);
+      heat.sample_count[i] = sample_count[i];
+    }
+  return heat;
+}
+
+#endif
@@ -2,6 +2,9 @@
 #define HITABLE_H
 
 #include "ray.h"
+#include "aabb.h"
+#include "render_stats.h"
+#include "ray_packet.h"
 
 class material;
 
@@ -9,16 +12,107 @@ struct hit_record
 {
   float t;
   float t_far;
+  float u, v;        // surface coordinates for textures, 0 where a primitive has none
   vec3 p;
   vec3 normal;
   material *mat_ptr; // tells us how rays interact with the surface
 };
 
+// Closest hit found so far for every lane of a ray_packet
+struct packet_hits
+{
+  // Lanes up to size search out to t_max, padding lanes are closed off with t = 0
+  void reset(int size, float t_max)
+  {
+    for (int i = 0; i < MAX_PACKET; ++i)
+      {
+	t[i] = i < size ? t_max : 0.0f;
+	hit[i] = false;
+      }
+  }
+
+  alignas(32) float t[MAX_PACKET];  // doubles as the t_max of every lane
+  bool hit[MAX_PACKET];
+  hit_record rec[MAX_PACKET];
+};
+
+/* Built in primitives, which the bvh leaves call through hit_primitive() and
+   occluded_primitive() without a virtual call. Primitives defined elsewhere
+   are HITABLE_OTHER and go through the virtual functions. */
+enum hitable_kind
+  {
+    HITABLE_OTHER,
+    HITABLE_SPHERE,
+    HITABLE_MOVING_SPHERE,
+    HITABLE_TRIANGLE,
+    HITABLE_QUAD,
+    HITABLE_PLANE,
+    HITABLE_SPHERE_SET,
+    HITABLE_MESH_FACE
+  };
+
 class hitable
 {
  public:
+  hitable() : kind(HITABLE_OTHER) {}
+  explicit hitable(hitable_kind k) : kind(k) {}
   virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
-  // virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+  // Returns false for unbounded primitives (e.g. infinite planes)
+  virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+  // Boxes at t0 and t1 whose interpolation bounds the primitive at every time in
+  // between, used by the motion bvh. The default is the whole interval's box at both ends
+  virtual bool motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const
+  {
+    if (!bounding_box(t0, t1, box0))
+      return false;
+    box1 = box0;
+    return true;
+  }
+  // Closest hits for a packet of coherent rays. The default traces the lanes one at a time
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const;
+  // Any hit query for shadow rays: true as soon as anything lies between t_min and t_max
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
+  // Area lights: random() picks a direction from o towards the surface and pdf_value()
+  // is the solid angle density of that choice, 0 for primitives that cannot be sampled
+  virtual float pdf_value(const vec3& o, const vec3& v) const { return 0.0f; }
+  virtual vec3 random(const vec3& o) const { return vec3(1.0f, 0.0f, 0.0f); }
+
+  hitable_kind kind;
 };
 
+// Switch over kind, defined in primitives.h once every built in primitive is known
+inline bool hit_primitive(const hitable *h, const ray& r, float t_min, float t_max, hit_record& rec);
+inline bool occluded_primitive(const hitable *h, const ray& r, float t_min, float t_max);
+
+/* Primitive that blocked the last occluded() query on this thread. Shadow rays
+   from neighbouring points tend to be blocked by the same primitive, so it is
+   tested before the scene. Aggregates only record leaves that are not
+   themselves aggregates. */
+thread_local const hitable *LAST_OCCLUDER = nullptr;
+
+// Called by aggregates when child blocked a ray, keeps the innermost primitive
+inline void note_occluder(const hitable *before, const hitable *child)
+{
+  if (LAST_OCCLUDER == before)
+    LAST_OCCLUDER = child;
+}
+
+void hitable::hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const
+{
+  for (int i = 0; i < rp.size; ++i)
+    {
+      if (hit(rp.get(i), t_min, hits.t[i], hits.rec[i]))
+	{
+	  hits.t[i] = hits.rec[i].t;
+	  hits.hit[i] = true;
+	}
+    }
+}
+
+bool hitable::occluded(const ray& r, float t_min, float t_max) const
+{
+  hit_record rec;
+  return hit(r, t_min, t_max, rec);
+}
+
 #endif
@@ -9,6 +9,9 @@ class hitable_list: public hitable
   hitable_list() {}
   hitable_list(hitable **l, int n) { list = l, list_size = n; }
   virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
   hitable **list;
   int list_size;
 };
@@ -20,7 +23,7 @@ bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec)
   double closest_so_far = t_max;
   for (int i = 0; i < list_size; ++i)
     {
-      if (list[i]->hit(r, t_min, closest_so_far, temp_rec))
+      if (hit_primitive(list[i], r, t_min, closest_so_far, temp_rec))
 	{
 	  hit_anything = true;
 	  closest_so_far = temp_rec.t;
@@ -30,4 +33,37 @@ bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec)
   return hit_anything;
 }
 
+void hitable_list::hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const
+{
+  for (int i = 0; i < list_size; ++i)
+    list[i]->hit_packet(rp, t_min, hits);
+}
+
+bool hitable_list::occluded(const ray& r, float t_min, float t_max) const
+{
+  const hitable *before = LAST_OCCLUDER;
+  for (int i = 0; i < list_size; ++i)
+    {
+      if (occluded_primitive(list[i], r, t_min, t_max))
+	{
+	  note_occluder(before, list[i]);
+	  return true;
+	}
+    }
+  return false;
+}
+
+bool hitable_list::bounding_box(float t0, float t1, aabb& box) const
+{
+  box = aabb();
+  for (int i = 0; i < list_size; ++i)
+    {
+      aabb temp_box;
+      if (!list[i]->bounding_box(t0, t1, temp_box))
+	return false;
+      box.expand(temp_box);
+    }
+  return list_size > 0;
+}
+
 #endif
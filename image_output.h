@@ -0,0 +1,91 @@
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "tile_scheduler.h"
+
+/* Streams a framebuffer to disk while it is still being rendered. Render
+   threads report finished tiles, and a background thread hands every scanline
+   to the writer as soon as all of its pixels are in, so file I/O overlaps with
+   tracing and other tools can start reading the partial frame. */
+class image_output
+{
+ public:
+  image_output(const framebuffer& fb, image_writer *w, const std::string& file_name);
+  ~image_output();
+
+  // Called by the render threads once every pixel of the tile is in the framebuffer
+  void tile_done(const tile& t);
+  // Blocks until the last scanline has been written and the file is closed
+  void finish();
+
+ private:
+  void writer_loop();
+
+  const framebuffer& fb;
+  image_writer *writer;
+  std::mutex lock;
+  std::condition_variable row_ready;
+  std::vector<int> remaining;  // pixels still missing per row
+  std::thread thread;
+};
+
+image_output::image_output(const framebuffer& f, image_writer *w, const std::string& file_name)
+  : fb(f), writer(w), remaining(f.height, f.width)
+{
+  writer->open(file_name, fb.width, fb.height);
+  thread = std::thread(&image_output::writer_loop, this);
+}
+
+image_output::~image_output()
+{
+  finish();
+  delete writer;
+}
+
+void image_output::tile_done(const tile& t)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (int y = t.y0; y < t.y1; ++y)
+    remaining[y] -= t.x1 - t.x0;
+  row_ready.notify_one();
+}
+
+void image_output::finish()
+{
+  if (thread.joinable())
+    thread.join();
+}
+
+void image_output::writer_loop()
+{
+  for (int n = 0; n < fb.height; ++n)
+    {
+      int y = writer->bottom_up() ? n : fb.height - 1 - n;
+      {
+	std::unique_lock<std::mutex> guard(lock);
+	row_ready.wait(guard, [&]() { return remaining[y] == 0; });
+      }
+      writer->write_row(fb.row(y));
+    }
+  writer->close();
+}
+
+// Write a finished framebuffer in one go on the calling thread
+void write_image(const framebuffer& fb, const std::string& file_name)
+{
+  image_writer *writer = make_writer(file_name);
+  writer->open(file_name, fb.width, fb.height);
+  for (int n = 0; n < fb.height; ++n)
+    writer->write_row(fb.row(writer->bottom_up() ? n : fb.height - 1 - n));
+  writer->close();
+  delete writer;
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "vec3.h"
+
+/* Output stage. A writer receives finished scanlines of linear radiance one at
+   a time, in the order its file format stores them, and streams them straight
+   to disk. */
+
+class image_writer
+{
+ public:
+  virtual ~image_writer() {}
+  virtual bool open(const std::string& file_name, int width, int height) = 0;
+  virtual void write_row(const vec3 *row) = 0;
+  virtual void close() = 0;
+  // Formats that store the bottom scanline first
+  virtual bool bottom_up() const { return false; }
+};
+
+// Gamma 2 correct and quantize a linear value to 8 bits
+inline unsigned char to_byte(float c)
+{
+  int i = int(255.99f * sqrt(c > 0.0f ? c : 0.0f));
+  return (unsigned char)(i > 255 ? 255 : i);
+}
+
+// Binary P6 ppm
+class ppm_writer : public image_writer
+{
+ public:
+  virtual bool open(const std::string& file_name, int w, int h)
+  {
+    width = w;
+    out.open(file_name.c_str(), std::ios::binary);
+    out << "P6\n" << w << " " << h << "\n255\n";
+    bytes.resize(3 * w);
+    return out.good();
+  }
+  virtual void write_row(const vec3 *row)
+  {
+    for (int i = 0; i < width; ++i)
+      {
+	bytes[3*i + 0] = to_byte(row[i].r());
+	bytes[3*i + 1] = to_byte(row[i].g());
+	bytes[3*i + 2] = to_byte(row[i].b());
+      }
+    out.write((const char *)&bytes[0], bytes.size());
+    out.flush();
+  }
+  virtual void close() { out.close(); }
+
+  std::ofstream out;
+  std::vector<unsigned char> bytes;
+  int width;
+};
+
+// Portable float map, keeps the unclamped linear radiance
+class pfm_writer : public image_writer
+{
+ public:
+  virtual bool open(const std::string& file_name, int w, int h)
+  {
+    width = w;
+    out.open(file_name.c_str(), std::ios::binary);
+    // A negative scale marks the data as little endian
+    uint16_t probe = 1;
+    bool little = *(unsigned char *)&probe == 1;
+    out << "PF\n" << w << " " << h << "\n" << (little ? "-1.0" : "1.0") << "\n";
+    floats.resize(3 * w);
+    return out.good();
+  }
+  virtual void write_row(const vec3 *row)
+  {
+    for (int i = 0; i < width; ++i)
+      {
+	floats[3*i + 0] = row[i].r();
+	floats[3*i + 1] = row[i].g();
+	floats[3*i + 2] = row[i].b();
+      }
+    out.write((const char *)&floats[0], floats.size() * sizeof(float));
+    out.flush();
+  }
+  virtual void close() { out.close(); }
+  virtual bool bottom_up() const { return true; }
+
+  std::ofstream out;
+  std::vector<float> floats;
+  int width;
+};
+
+/* 8 bit RGB png. Rows are stored in uncompressed deflate blocks, one IDAT chunk
+   per row, so they can be written the moment they are finished and no
+   compression library is needed. */
+class png_writer : public image_writer
+{
+ public:
+ png_writer() : adler_a(1), adler_b(0) {}
+
+  virtual bool open(const std::string& file_name, int w, int h)
+  {
+    width = w;
+    out.open(file_name.c_str(), std::ios::binary);
+    const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    out.write((const char *)signature, 8);
+
+    std::vector<unsigned char> ihdr;
+    put_u32(ihdr, w);
+    put_u32(ihdr, h);
+    ihdr.push_back(8);  // bit depth
+    ihdr.push_back(2);  // truecolor
+    ihdr.push_back(0);  // deflate
+    ihdr.push_back(0);  // adaptive filtering
+    ihdr.push_back(0);  // no interlace
+    write_chunk("IHDR", ihdr);
+
+    // zlib header: deflate with a 32k window, no preset dictionary
+    std::vector<unsigned char> zlib_header;
+    zlib_header.push_back(0x78);
+    zlib_header.push_back(0x01);
+    write_chunk("IDAT", zlib_header);
+
+    scanline.resize(1 + 3 * w);
+    return out.good();
+  }
+
+  virtual void write_row(const vec3 *row)
+  {
+    scanline[0] = 0;  // filter type none
+    for (int i = 0; i < width; ++i)
+      {
+	scanline[1 + 3*i + 0] = to_byte(row[i].r());
+	scanline[1 + 3*i + 1] = to_byte(row[i].g());
+	scanline[1 + 3*i + 2] = to_byte(row[i].b());
+      }
+    update_adler(scanline);
+
+    // Stored blocks hold at most 65535 bytes
+    std::vector<unsigned char> data;
+    for (size_t start = 0; start < scanline.size(); start += 65535)
+      {
+	size_t len = std::min(scanline.size() - start, (size_t)65535);
+	data.push_back(0);  // not the final block, stored
+	data.push_back(len & 0xff);
+	data.push_back((len >> 8) & 0xff);
+	data.push_back(~len & 0xff);
+	data.push_back((~len >> 8) & 0xff);
+	data.insert(data.end(), scanline.begin() + start, scanline.begin() + start + len);
+      }
+    write_chunk("IDAT", data);
+    out.flush();
+  }
+
+  virtual void close()
+  {
+    // Empty final block followed by the adler32 checksum of all the rows
+    std::vector<unsigned char> data;
+    data.push_back(1);
+    data.push_back(0x00);
+    data.push_back(0x00);
+    data.push_back(0xff);
+    data.push_back(0xff);
+    put_u32(data, (adler_b << 16) | adler_a);
+    write_chunk("IDAT", data);
+    write_chunk("IEND", std::vector<unsigned char>());
+    out.close();
+  }
+
+ private:
+  static void put_u32(std::vector<unsigned char>& v, uint32_t x)
+  {
+    v.push_back(x >> 24);
+    v.push_back((x >> 16) & 0xff);
+    v.push_back((x >> 8) & 0xff);
+    v.push_back(x & 0xff);
+  }
+
+  static uint32_t crc32(uint32_t crc, const unsigned char *buf, size_t len)
+  {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready)
+      {
+	for (uint32_t n = 0; n < 256; ++n)
+	  {
+	    uint32_t c = n;
+	    for (int k = 0; k < 8; ++k)
+	      c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+	    table[n] = c;
+	  }
+	table_ready = true;
+      }
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+      crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+  }
+
+  void update_adler(const std::vector<unsigned char>& data)
+  {
+    for (size_t i = 0; i < data.size(); ++i)
+      {
+	adler_a = (adler_a + data[i]) % 65521;
+	adler_b = (adler_b + adler_a) % 65521;
+      }
+  }
+
+  void write_chunk(const char *type, const std::vector<unsigned char>& data)
+  {
+    std::vector<unsigned char> header;
+    put_u32(header, data.size());
+    out.write((const char *)&header[0], 4);
+    out.write(type, 4);
+    uint32_t crc = crc32(0, (const unsigned char *)type, 4);
+    if (!data.empty())
+      {
+	out.write((const char *)&data[0], data.size());
+	crc = crc32(crc, &data[0], data.size());
+      }
+    std::vector<unsigned char> footer;
+    put_u32(footer, crc);
+    out.write((const char *)&footer[0], 4);
+  }
+
+  std::ofstream out;
+  std::vector<unsigned char> scanline;
+  uint32_t adler_a, adler_b;
+  int width;
+};
+
+// Pick a writer from the file extension, binary ppm when it is not recognised
+image_writer *make_writer(const std::string& file_name)
+{
+  size_t dot = file_name.rfind('.');
+  std::string ext = dot == std::string::npos ? "" : file_name.substr(dot + 1);
+  if (ext == "pfm")
+    return new pfm_writer;
+  if (ext == "png")
+    return new png_writer;
+  return new ppm_writer;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <string.h>
+#include "hitable.h"
+#include "transform.h"
+
+/* A shared object placed in the world by an affine transform, so a model
+   repeated many times is stored once with its own bvh and every copy costs
+   only a pointer and the transform. Rays are moved into object space without
+   normalising the direction, so the distance t along them is the same in both
+   spaces; the hit point is taken on the world ray and the normal moved back by
+   the inverse transposed. Emitters inside an instance glow when hit but are
+   not sampled as lights. */
+class instance : public hitable
+{
+ public:
+  instance(const hitable *o, const transform& world)
+    : object(o), to_world(world), to_object(world.inverse()) {}
+  virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual bool motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const;
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
+
+  const hitable *object;
+  transform to_world;
+  transform to_object;
+
+ private:
+  ray object_ray(const ray& r) const { return ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time()); }
+  void to_world_hit(const ray& r, hit_record& rec) const
+  {
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+  }
+  // Box around the eight corners of the object space box
+  aabb world_box(const aabb& box) const;
+};
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+  if (!hit_primitive(object, object_ray(r), t_min, t_max, rec))
+    return false;
+  to_world_hit(r, rec);
+  return true;
+}
+
+void instance::hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const
+{
+  ray_packet local;
+  local.size = rp.size;
+  for (int i = 0; i < rp.lanes(); ++i)
+    local.set(i, object_ray(rp.get(i)));
+  // A lane the object hit has come closer
+  float before[MAX_PACKET];
+  memcpy(before, hits.t, sizeof(before));
+  object->hit_packet(local, t_min, hits);
+  for (int i = 0; i < rp.size; ++i)
+    {
+      if (hits.t[i] < before[i])
+	to_world_hit(rp.get(i), hits.rec[i]);
+    }
+}
+
+bool instance::occluded(const ray& r, float t_min, float t_max) const
+{
+  const hitable *before = LAST_OCCLUDER;
+  if (!occluded_primitive(object, object_ray(r), t_min, t_max))
+    return false;
+  // The primitive inside only blocks rays in object space, the instance is cached instead
+  if (LAST_OCCLUDER != before)
+    LAST_OCCLUDER = this;
+  return true;
+}
+
+aabb instance::world_box(const aabb& box) const
+{
+  aabb result;
+  for (int c = 0; c < 8; ++c)
+    result.expand(to_world.point(vec3(c & 1 ? box.max().x() : box.min().x(),
+				      c & 2 ? box.max().y() : box.min().y(),
+				      c & 4 ? box.max().z() : box.min().z())));
+  return result;
+}
+
+bool instance::bounding_box(float t0, float t1, aabb& box) const
+{
+  aabb local;
+  if (!object->bounding_box(t0, t1, local))
+    return false;
+  box = world_box(local);
+  return true;
+}
+
+// Interpolating the corners commutes with the transform, so the moved boxes still bound the motion
+bool instance::motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const
+{
+  aabb local0, local1;
+  if (!object->motion_bounds(t0, t1, local0, local1))
+    return false;
+  box0 = world_box(local0);
+  box1 = world_box(local1);
+  return true;
+}
+
+#endif
@@ -1,361 +1,207 @@
 #include <iostream>
 #include <fstream>
-#include <cfloat>
-#include <algorithm>
-#include <stdlib.h>
-#include <ctime>
-#include <thread>
-// Defined primitive shapes
-#include "sphere.h"
-#include "plane.h"
-#include "triangle.h"
-#include "moving_sphere.h"
-
-#include "hitable_list.h"
-#include "camera.h"
-#include "material.h"
-#include "all_scenes.h"
-
-# define M_PI  3.14159265358979323846  /* pi */
-
-// === Lighting configurations === //
-
-//#define GLOBAL    // Using Global Illumination
-//#define SHADOWS // For direct shadow casting (Automatically off if GI is turned on)
-//#define THREADED // Enable for 4 thread rendering
-
-// =============================== //
-
-// Dimensions of image file
-const int WIDTH = 640;
-const int HEIGHT = 480;
-
-// Store the color onto a seperate 2D canvas and then print it out after all threads have completed
-vec3 CANVAS[WIDTH][HEIGHT];
-
-// Number of samples to perform for anti aliasing 
-const int SAMPLES = 250;
-const int DEPTH = 4;
-
-const vec3 LIGHTPOS(-5, 3.5, 3);
-float SPEC_STRENGTH = 0.090f;
-
-// TODO place into seperate scenes
-// Camera position and direction
-//const vec3 LOOKFROM(-1.0f, 5.0f, -3.0f);
-//const vec3 LOOKFROM(2.0f, 2.0f, -1.0f);
-//const vec3 LOOKFROM(5.0f, 3.5f, 3.0f);
-//const vec3 LOOKAT(0.0f, 0.0f, 0.0f);
-vec3 LOOKFROM = vec3(50.0f, 52.0f, 295.6f);
-vec3 LOOKAT = unit_vector(vec3(0, -0.042612, -1));
-
-// Render statistics
-unsigned long long int numRays = 0;
-unsigned long long int numTests = 0;
-unsigned long long int numIntersections = 0;
-
-const int SHADOW_DEPTH = 1;  // Total number of shadows to trace. 1 for hard shadows. Around >= 20 seems to give clean enough soft-shadows
-bool shadow(const hitable *world, const hit_record& rec)
+#include <chrono>
+#include "render.h"
+#include "wavefront.h"
+#include "tile_scheduler.h"
+#include "image_output.h"
+#include "checkpoint.h"
+#include "distributed.h"
+#include "denoiser.h"
+
+// Print a summary of the merged per-thread counters and write them out as json
+void printStats(const std::string& scene_name, int threads, double seconds)
 {
-    hit_record temp;
-    ray lightDir;
-    if (SHADOW_DEPTH > 1)
-        lightDir = ray(rec.p, unit_vector((LIGHTPOS - rec.p) + 0.1*random_in_unit_sphere()), 0.0f); // Project ray to light with slight offset to make shadows more soft
-    else
-        lightDir = ray(rec.p, unit_vector(LIGHTPOS - rec.p), 0.0f); // No offset for hard-shadows
-    if (world->hit(lightDir, 0.001f, FLT_MAX, temp))
+    thread_stats stats = STATS.merged();
+    int minutes = int(seconds) / 60;
+    std::cout << "Render time    : " << minutes << "m " << ":" << (seconds - 60.0 * minutes) << "s" << std::endl;
+
+    std::cout << "# Primary Rays : " << stats.primary_rays << std::endl;
+    std::cout << "# Second. Rays : " << stats.secondary_rays << std::endl;
+    std::cout << "# Shadow Rays  : " << stats.shadow_rays << std::endl;
+    std::cout << "# Occl. Cached : " << stats.occluder_cache_hits << std::endl;
+    uint64_t tests = 0, hits = 0;
+    for (int i = 0; i < NUM_PRIM_TYPES; ++i)
     {
-        return true;
+        tests += stats.tests[i];
+        hits += stats.hits[i];
     }
-    return false;
+    std::cout << "# Inter Tests  : " << tests << std::endl;
+    std::cout << "# Intersections: " << hits << std::endl;
+    std::cout << "Rays / second  : " << (seconds > 0.0 ? stats.total_rays() / seconds : 0.0) << std::endl;
+    std::cout << "Samples / pixel: " << CANVAS.mean_samples() << std::endl;
+
+    write_stats_json(SETTINGS.stats, scene_name, SETTINGS.width, SETTINGS.height, SETTINGS.samples, CANVAS.mean_samples(), threads, seconds, stats);
 }
 
-vec3 softShadow(const hitable *world, const hit_record& rec, float& spec)
+// Render every tile of the frame with the integrator specialised for MODE
+template <lighting_mode MODE>
+void renderTiles(tile_scheduler& scheduler, const scene& sc, camera& cam, image_output& output, checkpoint_writer *checkpoint)
 {
-    vec3 shade(0.3f, 0.3f, 0.3f);
-    vec3 nonshade(1.0f, 1.0f, 1.0f);
-    int count = 0; // Total number of shadow rays that intersected an object in the scene
-    for (int depth = 0; depth < SHADOW_DEPTH; ++depth)
-    {
-        if (shadow(world, rec))
-            count++;
-    }
-    // Compute specular highlight
-    if (count == 0) {
-        vec3 viewDir = unit_vector(LOOKFROM - rec.p);
-        vec3 lightDir = unit_vector(LIGHTPOS - rec.p);
-        vec3 reflectDir = reflect(-lightDir, rec.normal);
-        spec = SPEC_STRENGTH * std::pow(std::max(dot(viewDir, reflectDir), 0.0f), 16);
-        //  spec *= (1.0f - float(count))/float(SHADOW_DEPTH);
-    }
-    return nonshade - (nonshade - shade)*(float(count) / float(SHADOW_DEPTH));
+    scheduler.run([&](const tile& t) {
+                      traceTile<MODE>(t.x0, t.x1, t.y0, t.y1, sc, cam);
+                      output.tile_done(t);
+                      if (checkpoint)
+                          checkpoint->tile_done(t);
+                  },
+                  printProgress);
 }
 
-#ifndef GLOBAL
-vec3 color(const ray& r, hitable *world, int depth)
+// Render the tiles a coordinator sends over fd until it ends the frame
+template <lighting_mode MODE>
+bool workTiles(int fd, int threads, const scene& sc, camera& cam)
 {
-    hit_record rec;
-    if (world->hit(r, 0.001f, FLT_MAX, rec))
-    {
-        ray scattered;
-        vec3 attenuation;
-        float spec;  // Specular coefficient 
-
-        // check if area should be shadowed
-        vec3 shade = softShadow(world, rec, spec);
-
-        if (depth < DEPTH && rec.mat_ptr->scatter(r, rec, attenuation, scattered, LIGHTPOS))
-        {
-            numIntersections++;
+    return run_worker(fd, threads, render_fingerprint(SETTINGS), CANVAS,
+                      [&](const tile& t) { traceTile<MODE>(t.x0, t.x1, t.y0, t.y1, sc, cam); });
+}
 
-            /* reflective_weight is the percentage by which the object will reflect
-               zero reflective_weight will give only diffuse reflection */
-            float weight = rec.mat_ptr->reflect_weight;
-#ifdef SHADOWS
-            return (spec*vec3(1.0f, 1.0f, 1.0f)) + shade*attenuation*color(scattered, world, depth+1); // With shadows
-#else 
-            return attenuation*color(scattered, world, depth + 1);
-#endif
-        }
-        else
-        {
-            return vec3(0.0f, 0.0f, 0.0f);
-        }
-    }
-    else
+bool serveTiles(const scene& sc, camera& cam)
+{
+    int fd = SETTINGS.worker_fd >= 0 ? SETTINGS.worker_fd : connect_to_coordinator(SETTINGS.connect);
+    if (fd < 0)
+        return false;
+    int threads = SETTINGS.threads > 0 ? SETTINGS.threads : default_thread_count();
+    switch (SETTINGS.mode)
     {
-        vec3 unit_direction = unit_vector(r.direction());
-        float t = 0.5f*(unit_direction.y() + 1.0f);
-        return (1.0f - t)*vec3(1.0f, 1.0f, 1.0f) + t*vec3(0.5f, 0.7f, 1.0f);
+    case LIGHT_SHADOWS:
+        return workTiles<LIGHT_SHADOWS>(fd, threads, sc, cam);
+    case LIGHT_GLOBAL:
+        return workTiles<LIGHT_GLOBAL>(fd, threads, sc, cam);
+    default:
+        return workTiles<LIGHT_DIRECT>(fd, threads, sc, cam);
     }
 }
-#else 
-vec3 color(const ray& r, hitable *world, int depth)
-{
-    hit_record rec;
-    if (world->hit(r, 0.001f, FLT_MAX, rec))
-    {
-        ray scattered;
-        vec3 attenuation;
-        float spec;  // Specular coefficient 
 
-        // check if area should be shadowed
-        vec3 shade = softShadow(world, rec, spec);
-
-        if (depth < DEPTH && rec.mat_ptr->scatter(r, rec, attenuation, scattered, LIGHTPOS))
-        {
-            numIntersections++;
+int main(int argc, char** argv)
+{
+    if (!parse_args(argc, argv, SETTINGS))
+        return 1;
 
-            /* reflective_weight is the percentage by which the object will reflect
-               zero reflective_weight will give only diffuse reflection */
-            float weight = rec.mat_ptr->reflect_weight;
+    const int WIDTH = SETTINGS.width;
+    const int HEIGHT = SETTINGS.height;
+    std::string file_name = SETTINGS.output;
+    CANVAS = framebuffer(WIDTH, HEIGHT);
 
-            return attenuation*color(scattered, world, depth + 1);
-            //return (spec*vec3(1.0f, 1.0f, 1.0f)) + shade*attenuation*color(scattered, world, depth+1); // With shadows
-        }
-        else
-        {
-            return vec3(0.0f, 0.0f, 0.0f);
-        }
-    }
-    else
+    // Scenes are defined in the all_tests.h file
+    RENDER_SEED = SETTINGS.seed;
+    std::string scene_name = SETTINGS.scene;
+    scene world = build_scene(scene_name);
+    if (!world.world)
     {
-        vec3 unit_direction = unit_vector(r.direction());
-        float t = 0.5f*(unit_direction.y() + 1.0f);
-        return (1.0f - t)*vec3(1.0f, 1.0f, 1.0f) + t*vec3(0.5f, 0.7f, 1.0f);
+        // Files report their own errors
+        if (is_scene_file(scene_name))
+            return 1;
+        std::cerr << "Unknown scene " << scene_name << ", available scenes:";
+        for (int i = 0; i < NUM_SCENES; ++i)
+            std::cerr << " " << SCENES[i].name;
+        std::cerr << std::endl;
+        return 1;
     }
-}
-#endif 
 
+    // Every scene brings its own camera
+    camera cam = world.make_camera(float(WIDTH) / float(HEIGHT));
 
-/* Progress bar from razzak on stackoverflow 
- * https://stackoverflow.com/questions/14539867/how-to-display-a-progress-indicator-in-pure-c-c-cout-printf/14539953
- */
-#define PBSTR "======================================================"
-#define PBWIDTH 60
-void printProgress (double percentage)
-{
-    int val = (int) (percentage * 100);
-    int lpad = (int) (percentage * PBWIDTH);
-    int rpad = PBWIDTH - lpad;
-    printf ("\r%3d%% [%.*s%*s]", val, lpad, PBSTR, rpad, "");
-    fflush (stdout);
-}
-
-void putPixel(int x, int y, const vec3& color)
-{
-    // Make sure the pixel is within the bounds of the canvas
-    if ((x > 0 && x < WIDTH) && (y > 0 && y < HEIGHT))
-    {
-        CANVAS[x][y] = color;        
-    }
-}
+    // Workers only trace tiles for a coordinator, which writes the image
+    if (SETTINGS.worker())
+        return serveTiles(world, cam) ? 0 : 1;
 
-// Trace from the camera to the image plane based on the start and end positions
-void trace(int minX, int maxX, int minY, int maxY, hitable* world, camera cam)
-{
-    for (int j = maxY - 1; j >= minY; --j)
+    // Carry on from an earlier run of the same render
+    checkpoint_info info = { scene_name, int(SETTINGS.mode), sample_fingerprint(SETTINGS) };
+    checkpoint_writer *checkpoint = nullptr;
+    if (!SETTINGS.checkpoint.empty())
     {
-        for (int i = minX; i < maxX; ++i)
+        if (checkpoint_exists(SETTINGS.checkpoint))
         {
-            vec3 col(0.0f, 0.0f, 0.0f);
-            for (int s = 0; s < SAMPLES; ++s)
-            {
-                float u = float(i + drand48()) / float(WIDTH);
-                float v = float(j + drand48()) / float(HEIGHT);
-                ray r = cam.get_ray(u, v);
-                vec3 p = r.point_at_parameter(2.0f);
-                col += color(r, world, 0);
-            }
-            col /= float(SAMPLES);
-            col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-            int ir = int(255.99 * col.r());
-            int ig = int(255.99 * col.g());
-            int ib = int(255.99 * col.b());
-
-            // if any component is greater than max value, set it to 255
-            if (ir > 255) ir = 255;
-            if (ig > 255) ig = 255;
-            if (ib > 255) ib = 255;
-
-            putPixel(i, j, vec3(ir, ig, ib)); 
+            if (!load_checkpoint(SETTINGS.checkpoint, CANVAS, info))
+                return 1;
+            std::cout << "Resuming " << SETTINGS.checkpoint << " at " << CANVAS.mean_samples() << " samples per pixel" << std::endl;
         }
-        // Display the progress percentage
-        printProgress((float)(maxY - j) / maxY);
-        //std::thread progressBarThread(printProgress, ((float)(HEIGHT - j)/(float)HEIGHT));
+        checkpoint = new checkpoint_writer(CANVAS, info, SETTINGS.checkpoint, SETTINGS.checkpoint_interval);
     }
-    std::cout << std::endl;
-}
-
-void printCanvas()
-{
-    std::string file_name = "output_render.ppm";
-
-    std::ofstream myfile;
-    myfile.open(file_name);
-    myfile << "P3\n" << WIDTH << " " << HEIGHT << "\n255\n";
 
-    vec3 pixel; 
-    // Output to a ppm file
-    for (int j = HEIGHT - 1; j >= 0; --j)
+    // Hand the tiles to worker processes running this same command line
+    tile_coordinator *coordinator = nullptr;
+    if (SETTINGS.coordinator())
     {
-        for (int i = 0; i < WIDTH; ++i)
+        coordinator = new tile_coordinator(split_tiles(WIDTH, HEIGHT, SETTINGS.tile_size), CANVAS, render_fingerprint(SETTINGS));
+        int threads = SETTINGS.threads > 0 ? SETTINGS.threads : std::max(1, default_thread_count() / std::max(1, SETTINGS.workers));
+        std::vector<std::string> args(argv, argv + argc);
+        args.push_back("--threads");
+        args.push_back(std::to_string(threads));
+        if (!coordinator->spawn_workers(SETTINGS.workers, args) || (SETTINGS.listen > 0 && !coordinator->listen_on(SETTINGS.listen)))
         {
-            pixel = CANVAS[i][j];
-            myfile << pixel.r() << " " << pixel.g() << " " << pixel.b() << "\n";
+            delete coordinator;
+            delete checkpoint;
+            return 1;
         }
     }
-    myfile.close();
-}
-
-int main()
-{
-    std::string file_name = "output_render.ppm";
 
-    std::ofstream myfile;
-    myfile.open(file_name);
-    myfile << "P3\n" << WIDTH << " " << HEIGHT << "\n255\n";
+    // Finished rows are written by a background thread while rendering continues
+    image_output output(CANVAS, make_writer(file_name), file_name);
 
-    float R = cos(M_PI / 4);
-
-    // Scenes are defined in the all_tests.h file
-    hitable* world = beer_test();
-
-    // Setup the camera
-    float dist_to_focus = 10.0;
-    float aperature = 0.0;
-    camera cam(LOOKFROM, LOOKAT, vec3(0.0, 1.0, 0.0), 20.0, float(WIDTH) / float(HEIGHT), aperature, dist_to_focus, 0.0, 1.0);
-
-#ifdef THREADED
-    std::cout << "Rendering to " << file_name << " at " << WIDTH << " x " << HEIGHT << " resolution: with 4 threads." << std::endl;
-
-    std::vector<std::thread> renderThreads;
-
-    clock_t startTime = clock();
-    // Top Left
-    renderThreads.push_back(std::thread(trace, 
-                0, WIDTH/2, 
-                HEIGHT/2, HEIGHT, 
-                world, cam));            
-    // Top Right
-    renderThreads.push_back(std::thread(trace, 
-                WIDTH/2, WIDTH, 
-                HEIGHT/2, HEIGHT, 
-                world, cam));            
-    // Bottom Left
-    renderThreads.push_back(std::thread(trace, 
-                0, WIDTH/2, 
-                0, HEIGHT/2, 
-                world, cam));            
-    // Bottom Right
-    renderThreads.push_back(std::thread(trace, 
-                WIDTH/2, WIDTH,
-                0, HEIGHT/2, 
-                world, cam));            
-
-    // Wait for all threads to complete
-    for (int i = 0; i < renderThreads.size(); ++i)
+    tile_scheduler scheduler(WIDTH, HEIGHT, SETTINGS.tile_size, SETTINGS.threads);
+    std::cout << "Rendering " << scene_name << " to " << file_name << " at " << WIDTH << " x " << HEIGHT << " resolution: "
+              << mode_name(SETTINGS.mode) << " lighting with ";
+    if (coordinator)
     {
-        renderThreads[i].join();
+        std::cout << SETTINGS.workers << " worker processes";
+        if (SETTINGS.listen > 0)
+            std::cout << " and any that join on port " << SETTINGS.listen;
+        std::cout << "." << std::endl;
     }
+    else
+        std::cout << scheduler.thread_count() << " threads." << std::endl;
 
-    clock_t finishTime = clock();
-    // Display performance stats
-    float minutes = (finishTime - startTime) / (CLOCKS_PER_SEC * 60);
-    float seconds = ( (finishTime - startTime) / CLOCKS_PER_SEC ) % 60;
-    std::cout << "Render time    : " << minutes << "m " << ":" << seconds << "s" << std::endl;
-
-    std::cout << "# Primary Rays : " << numRays << std::endl;
-    std::cout << "# Inter Tests  : " << numTests << std::endl;
-    std::cout << "# Intersections: " << numIntersections << std::endl;
-
-    printCanvas();
-#else
-    std::cout << "Rendering to " << file_name << " at " << WIDTH << " x " << HEIGHT << " resolution: no multithreading." << std::endl;
-    clock_t startTime = clock();
-    for (int j = HEIGHT - 1; j >= 0; --j)
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    bool complete = true;
+    int threads = scheduler.thread_count();
+    if (coordinator)
     {
-        for (int i = 0; i < WIDTH; ++i)
+        complete = coordinator->run([&](const tile& t) {
+                                        output.tile_done(t);
+                                        if (checkpoint)
+                                            checkpoint->tile_done(t);
+                                    },
+                                    printProgress);
+        threads = coordinator->thread_count();
+        delete coordinator;
+    }
+    else
+    {
+        switch (SETTINGS.mode)
         {
-            vec3 col(0.0f, 0.0f, 0.0f);
-            for (int s = 0; s < SAMPLES; ++s)
-            {
-                numRays++;
-                float u = float(i + drand48()) / float(WIDTH);
-                float v = float(j + drand48()) / float(HEIGHT);
-                ray r = cam.get_ray(u, v);
-                vec3 p = r.point_at_parameter(2.0f);
-                col += color(r, world, 0);
-            }
-            col /= float(SAMPLES);
-            col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-            int ir = int(255.99 * col.r());
-            int ig = int(255.99 * col.g());
-            int ib = int(255.99 * col.b());
-
-            // if any component is greater than max value, set it to 255
-            if (ir > 255) ir = 255;
-            if (ig > 255) ig = 255;
-            if (ib > 255) ib = 255;
-
-            myfile << ir << " " << ig << " " << ib << "\n";
+        case LIGHT_SHADOWS:
+            renderTiles<LIGHT_SHADOWS>(scheduler, world, cam, output, checkpoint);
+            break;
+        case LIGHT_GLOBAL:
+            renderTiles<LIGHT_GLOBAL>(scheduler, world, cam, output, checkpoint);
+            break;
+        default:
+            renderTiles<LIGHT_DIRECT>(scheduler, world, cam, output, checkpoint);
+            break;
         }
-        // Display the progress percentage
-        printProgress((float)(HEIGHT - j) / HEIGHT);
-        //std::thread progressBarThread(printProgress, ((float)(HEIGHT - j)/(float)HEIGHT));
     }
     std::cout << std::endl;
+    output.finish();
+    delete checkpoint;
 
-    clock_t finishTime = clock();
     // Display performance stats
-    float minutes = (finishTime - startTime) / (CLOCKS_PER_SEC * 60);
-    float seconds = ( (finishTime - startTime) / CLOCKS_PER_SEC ) % 60;
-    std::cout << "Render time    : " << minutes << "m " << ":" << seconds << "s" << std::endl;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    printStats(scene_name, threads, elapsed.count());
 
-    std::cout << "# Primary Rays : " << numRays << std::endl;
-    std::cout << "# Inter Tests  : " << numTests << std::endl;
-    std::cout << "# Intersections: " << numIntersections << std::endl;
-#endif
+    // The streamed frame is replaced by the filtered one
+    if (SETTINGS.denoise > 0 && complete)
+    {
+        startTime = std::chrono::steady_clock::now();
+        write_image(denoise(CANVAS, SETTINGS.denoise, SETTINGS.threads), file_name);
+        elapsed = std::chrono::steady_clock::now() - startTime;
+        std::cout << "Denoise time   : " << elapsed.count() << "s" << std::endl;
+    }
+
+    if (!SETTINGS.heatmap.empty())
+    {
+        write_image(CANVAS.sample_heatmap(), SETTINGS.heatmap);
+    }
 
-    return 0;
+    return complete ? 0 : 1;
 }
@@ -6,31 +6,65 @@ struct hit_record;
 #include <algorithm>
 #include <math.h>
 #include "ray.h"
+#include "random.h"
 #include "hitable.h"
 #include "texture.h"
 
 vec3 reflect(const vec3& v, const vec3& n);
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted);
 vec3 random_in_unit_sphere(void);
+vec3 random_cosine_direction(const vec3& n);
 float schlick(float cosine, float ref_idx);
 
 
+// Built in materials, called through material_scatter() and friends without a virtual call
+enum material_kind
+  {
+    MATERIAL_OTHER,
+    MATERIAL_CONSTANT_COLOR,
+    MATERIAL_LAMBERTIAN,
+    MATERIAL_DIFFUSE,
+    MATERIAL_EMISSIVE,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC
+  };
+
 class material
 {
  public:
+  material() : kind(MATERIAL_OTHER) {}
+  explicit material(material_kind k) : kind(k) {}
   virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos) const = 0;
+  // Light given off back along r_in, black for everything but emitters
+  virtual vec3 emitted(const ray& r_in, const hit_record& rec) const { return vec3(0.0f, 0.0f, 0.0f); }
+
+  /* Materials that can reflect towards any direction, so the lights can be
+     sampled from them directly. eval() is the BSDF times the cosine term and
+     pdf() the density scatter() picks that direction with. Mirrors, glass and
+     the point light materials are only followed through scatter(). */
+  virtual bool is_diffuse() const { return false; }
+  virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& direction) const { return vec3(0.0f, 0.0f, 0.0f); }
+  virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const { return 0.0f; }
+  // Surface color at the hit, what the denoiser divides out so it does not blur textures
+  virtual vec3 reflectance(const hit_record& rec) const { return vec3(1.0f, 1.0f, 1.0f); }
 
   float reflect_weight;  // used to generate a mix of specular and diffuse 
+  material_kind kind;
+
+ protected:
+  // Normals stay on the outside of closed surfaces, so materials that reflect
+  // from both sides turn them towards the side the ray came from
+  static vec3 facing(const ray& r_in, const hit_record& rec) { return dot(r_in.direction(), rec.normal) < 0.0f ? rec.normal : -rec.normal; }
 };
 
-class constant_color : public material
+class constant_color final : public material
 {
  public:
-  constant_color() { reflect_weight = 0.0f; }
- constant_color(const vec3& col) : albedo(col) { reflect_weight = 0.0f; }
+  constant_color() : material(MATERIAL_CONSTANT_COLOR) { reflect_weight = 0.0f; }
+ constant_color(const vec3& col) : material(MATERIAL_CONSTANT_COLOR), albedo(col) { reflect_weight = 0.0f; }
   virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos) const
   {
-    float diff = std::max(dot(rec.normal, unit_vector(light_pos - rec.p)), 0.0f); // Diffuse component
+    float diff = std::max(dot(facing(r_in, rec), unit_vector(light_pos - rec.p)), 0.0f); // Diffuse component
 	float d = (light_pos - rec.p).length();
 	//float atten = 1.0f / (1.0 + 0.09*d + 0.032*d*d);
 	//float atten = 1.0f;
@@ -62,17 +96,17 @@ class lambertian: public material
 */
 
 // Add slight gloss
-class lambertian : public material
+class lambertian final : public material
 {
 public:
-	lambertian(texture *a) : albedo(a) { reflect_weight = 0.0f; }
+	lambertian(texture *a) : material(MATERIAL_LAMBERTIAN), albedo(a) { reflect_weight = 0.0f; }
 	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos) const
 	{
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
 		scattered = ray(rec.p, reflected + 0.01*random_in_unit_sphere(), r_in.time());
 
-		float diff = std::max(dot(rec.normal, unit_vector(light_pos - rec.p)), 0.0f); // Diffuse component
-		attenuation = diff * albedo->value(0, 0, rec.p);
+		float diff = std::max(dot(facing(r_in, rec), unit_vector(light_pos - rec.p)), 0.0f); // Diffuse component
+		attenuation = diff * texture_value(albedo, rec.u, rec.v, rec.p);
 		return true;
 	}
 
@@ -80,16 +114,57 @@ public:
 	float reflect_weight;
 };
 
-class metal : public material
+// Ideal Lambertian reflector, scatters with a cosine weighted direction
+class diffuse final : public material
 {
  public:
- metal(const vec3& a) : albedo(a)
+ diffuse(texture *a) : material(MATERIAL_DIFFUSE), albedo(a) { reflect_weight = 0.0f; }
+  virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos) const
+  {
+    scattered = ray(rec.p, random_cosine_direction(facing(r_in, rec)), r_in.time());
+    // BSDF times cosine over pdf, everything but the albedo cancels
+    attenuation = texture_value(albedo, rec.u, rec.v, rec.p);
+    return true;
+  }
+  virtual bool is_diffuse() const { return true; }
+  virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& direction) const
+  {
+    float cosine = dot(facing(r_in, rec), unit_vector(direction));
+    return cosine > 0.0f ? texture_value(albedo, rec.u, rec.v, rec.p) * (cosine / float(M_PI)) : vec3(0.0f, 0.0f, 0.0f);
+  }
+  virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const
+  {
+    float cosine = dot(facing(r_in, rec), unit_vector(direction));
+    return cosine > 0.0f ? cosine / float(M_PI) : 0.0f;
+  }
+
+  texture *albedo;
+};
+
+// Area light material, emits from the front of the surface and reflects nothing
+class emissive final : public material
+{
+ public:
+ emissive(const vec3& c) : material(MATERIAL_EMISSIVE), color(c) { reflect_weight = 0.0f; }
+  virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos) const { return false; }
+  virtual vec3 emitted(const ray& r_in, const hit_record& rec) const
+  {
+    return dot(r_in.direction(), rec.normal) < 0.0f ? color : vec3(0.0f, 0.0f, 0.0f);
+  }
+
+  vec3 color;
+};
+
+class metal final : public material
+{
+ public:
+ metal(const vec3& a) : material(MATERIAL_METAL), albedo(a)
   {
     fuzz = 0.0f;
     reflect_weight = 1.0f;
   }
   
- metal(const vec3& a, float f) : albedo(a)
+ metal(const vec3& a, float f) : material(MATERIAL_METAL), albedo(a)
   {
     if (f < 1)
       fuzz = f;
@@ -99,7 +174,7 @@ class metal : public material
     reflect_weight = 1.0f;
   }
   
- metal(const vec3& a, float f, float r) : albedo(a)
+ metal(const vec3& a, float f, float r) : material(MATERIAL_METAL), albedo(a)
   {
     if (f < 1)
       fuzz = f;
@@ -116,11 +191,12 @@ class metal : public material
 
   virtual bool scatter(const ray& ray_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos) const
   {
-    vec3 reflected = reflect(unit_vector(ray_in.direction()), rec.normal);
+    vec3 normal = facing(ray_in, rec);
+    vec3 reflected = reflect(unit_vector(ray_in.direction()), normal);
     scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), ray_in.time());
-    float diff = std::max(dot(rec.normal, unit_vector(light_pos - rec.p)), 0.0f); // Diffuse component
+    float diff = std::max(dot(normal, unit_vector(light_pos - rec.p)), 0.0f); // Diffuse component
     attenuation = diff * albedo;
-    return (dot(scattered.direction(), rec.normal) > 0);
+    return (dot(scattered.direction(), normal) > 0);
   }
   
   vec3 albedo;
@@ -128,21 +204,21 @@ class metal : public material
   float reflect_weight;
 };
 
-class dielectric : public material
+class dielectric final : public material
 {
  public:
- dielectric(float ri) : ref_idx(ri)
+ dielectric(float ri) : material(MATERIAL_DIELECTRIC), ref_idx(ri)
   {
     albedo = vec3(1.0f, 1.0f, 1.0f);    
     reflect_weight = 0.0f;
     absorption = vec3(0.0f, 0.0f, 0.0f);
   }
- dielectric(const vec3& a, float ri) : albedo(a), ref_idx(ri)
+ dielectric(const vec3& a, float ri) : material(MATERIAL_DIELECTRIC), albedo(a), ref_idx(ri)
   {
     reflect_weight = 0.0f;
     absorption = vec3(0.0f, 0.0f, 0.0f);
   }  
- dielectric(const vec3& a, float ri, const vec3& absorp) : albedo(a), ref_idx(ri), absorption(absorp) { reflect_weight = 0.0f; }
+ dielectric(const vec3& a, float ri, const vec3& absorp) : material(MATERIAL_DIELECTRIC), albedo(a), ref_idx(ri), absorption(absorp) { reflect_weight = 0.0f; }
     
   virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos) const
   {
@@ -188,7 +264,7 @@ class dielectric : public material
 		scattered = ray(rec.p, reflected, r_in.time());
 		reflect_prob = 1.0;
 	}
-    if (drand48() < reflect_prob)
+    if (random_float() < reflect_prob)
 	{
 		scattered = ray(rec.p, reflected, r_in.time());
 	}
@@ -205,6 +281,71 @@ class dielectric : public material
   vec3 absorption;
 };
 
+/* The integrator calls materials through these, so the built in materials are
+   called directly and only materials defined elsewhere go through the vtable. */
+inline bool material_scatter(const material *m, const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, const vec3& light_pos)
+{
+  switch (m->kind)
+    {
+    case MATERIAL_CONSTANT_COLOR: return static_cast<const constant_color *>(m)->constant_color::scatter(r_in, rec, attenuation, scattered, light_pos);
+    case MATERIAL_LAMBERTIAN: return static_cast<const lambertian *>(m)->lambertian::scatter(r_in, rec, attenuation, scattered, light_pos);
+    case MATERIAL_DIFFUSE: return static_cast<const diffuse *>(m)->diffuse::scatter(r_in, rec, attenuation, scattered, light_pos);
+    case MATERIAL_EMISSIVE: return false;
+    case MATERIAL_METAL: return static_cast<const metal *>(m)->metal::scatter(r_in, rec, attenuation, scattered, light_pos);
+    case MATERIAL_DIELECTRIC: return static_cast<const dielectric *>(m)->dielectric::scatter(r_in, rec, attenuation, scattered, light_pos);
+    default: return m->scatter(r_in, rec, attenuation, scattered, light_pos);
+    }
+}
+
+inline vec3 material_emitted(const material *m, const ray& r_in, const hit_record& rec)
+{
+  switch (m->kind)
+    {
+    case MATERIAL_EMISSIVE: return static_cast<const emissive *>(m)->emissive::emitted(r_in, rec);
+    case MATERIAL_OTHER: return m->emitted(r_in, rec);
+    default: return vec3(0.0f, 0.0f, 0.0f);
+    }
+}
+
+inline bool material_is_diffuse(const material *m)
+{
+  return m->kind == MATERIAL_DIFFUSE || (m->kind == MATERIAL_OTHER && m->is_diffuse());
+}
+
+inline vec3 material_reflectance(const material *m, const hit_record& rec)
+{
+  switch (m->kind)
+    {
+    case MATERIAL_CONSTANT_COLOR: return static_cast<const constant_color *>(m)->albedo;
+    case MATERIAL_LAMBERTIAN: return texture_value(static_cast<const lambertian *>(m)->albedo, rec.u, rec.v, rec.p);
+    case MATERIAL_DIFFUSE: return texture_value(static_cast<const diffuse *>(m)->albedo, rec.u, rec.v, rec.p);
+    case MATERIAL_METAL: return static_cast<const metal *>(m)->albedo;
+    case MATERIAL_DIELECTRIC: return static_cast<const dielectric *>(m)->albedo;
+    case MATERIAL_OTHER: return m->reflectance(rec);
+    default: return vec3(1.0f, 1.0f, 1.0f);
+    }
+}
+
+inline vec3 material_eval(const material *m, const ray& r_in, const hit_record& rec, const vec3& direction)
+{
+  switch (m->kind)
+    {
+    case MATERIAL_DIFFUSE: return static_cast<const diffuse *>(m)->diffuse::eval(r_in, rec, direction);
+    case MATERIAL_OTHER: return m->eval(r_in, rec, direction);
+    default: return vec3(0.0f, 0.0f, 0.0f);
+    }
+}
+
+inline float material_pdf(const material *m, const ray& r_in, const hit_record& rec, const vec3& direction)
+{
+  switch (m->kind)
+    {
+    case MATERIAL_DIFFUSE: return static_cast<const diffuse *>(m)->diffuse::pdf(r_in, rec, direction);
+    case MATERIAL_OTHER: return m->pdf(r_in, rec, direction);
+    default: return 0.0f;
+    }
+}
+
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted)
 {
   vec3 i = unit_vector(v);
@@ -239,9 +380,20 @@ vec3 random_in_unit_sphere()
 {
   vec3 p;
   do {
-    p = 2.0*vec3(drand48(), drand48(), drand48()) - vec3(1.0f, 1.0f, 1.0f);    
+    p = 2.0*vec3(random_float(), random_float(), random_float()) - vec3(1.0f, 1.0f, 1.0f);    
   } while(p.squared_length() >= 1.0);
   return p;
 }
 
+// Direction around the unit vector n with a density proportional to the cosine
+vec3 random_cosine_direction(const vec3& n)
+{
+  float r1 = random_float(), r2 = random_float();
+  float phi = 2.0f * float(M_PI) * r1;
+  float s = sqrt(r2);
+  vec3 t, b;
+  orthonormal_basis(n, t, b);
+  return (cos(phi) * s) * t + (sin(phi) * s) * b + sqrt(1.0f - r2) * n;
+}
+
 #endif
@@ -0,0 +1,200 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <math.h>
+#include <vector>
+#include "vec3.h"
+#include "hitable.h"
+#include "bvh.h"
+
+/* Indexed triangle mesh. Positions, normals and texture coordinates live in
+   shared buffers and every face corner indexes into them separately, the same
+   way Wavefront OBJ files do, so vertices shared between faces are stored once.
+   The mesh builds its own bvh over its faces and goes into the scene as a
+   single hitable. */
+
+// Indices of one face corner, -1 when the mesh has no normal or uv for it
+struct mesh_corner
+{
+  int v, vt, vn;
+};
+
+class mesh;
+
+// Lightweight handle to one face, so the faces can be leaves of a bvh
+class mesh_face final : public hitable
+{
+ public:
+  mesh_face() : hitable(HITABLE_MESH_FACE) {}
+ mesh_face(const mesh *m, int f) : hitable(HITABLE_MESH_FACE), owner(m), face(f) {}
+  virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
+  // Distance and barycentric coordinates of the hit, shared by hit() and occluded()
+  bool intersect(const ray& r, float t_min, float t_max, float& t, float& b0, float& b1, float& b2) const;
+
+  const mesh *owner;
+  int face;
+};
+
+class mesh : public hitable
+{
+ public:
+  mesh() : mat_ptr(nullptr) {}
+  // Faces point back at their mesh, so it must stay where it was built
+  mesh(const mesh&) = delete;
+  mesh& operator=(const mesh&) = delete;
+  // Call once the buffers are filled in
+  void build();
+  virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const { return tree.hit(r, tmin, tmax, rec); }
+  virtual bool bounding_box(float t0, float t1, aabb& box) const { return tree.bounding_box(t0, t1, box); }
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const { tree.hit_packet(rp, t_min, hits); }
+  virtual bool occluded(const ray& r, float t_min, float t_max) const { return tree.occluded(r, t_min, t_max); }
+  int num_faces() const { return (int)corners.size() / 3; }
+
+  std::vector<vec3> positions;
+  std::vector<vec3> normals;
+  std::vector<float> uvs;             // two floats per texture coordinate
+  std::vector<mesh_corner> corners;   // three per face
+  material *mat_ptr;
+
+ private:
+  std::vector<mesh_face> faces;
+  bvh tree;
+};
+
+void mesh::build()
+{
+  int n = num_faces();
+  faces.resize(n);
+  std::vector<hitable*> list(n);
+  for (int i = 0; i < n; ++i)
+    {
+      faces[i] = mesh_face(this, i);
+      list[i] = &faces[i];
+    }
+  tree = bvh(n > 0 ? &list[0] : nullptr, n, 0.0f, 1.0f);
+}
+
+bool mesh_face::bounding_box(float t0, float t1, aabb& box) const
+{
+  const mesh_corner *c = &owner->corners[3 * face];
+  box = aabb();
+  for (int i = 0; i < 3; ++i)
+    box.expand(owner->positions[c[i].v]);
+  // Keep axis aligned faces from having a flat box
+  vec3 pad(1e-4f, 1e-4f, 1e-4f);
+  box = aabb(box.min() - pad, box.max() + pad);
+  return true;
+}
+
+/* Watertight ray/triangle test (Woop, Benthin and Wald 2013). The vertices are
+   moved into a space where the ray runs along +z from the origin, and the
+   point is inside when the three 2D edge functions agree in sign. Rays through
+   a shared edge or vertex hit exactly one of the faces, with no gaps, and both
+   sides of a face are hit. */
+bool mesh_face::intersect(const ray& r, float t_min, float t_max, float& t, float& b0, float& b1, float& b2) const
+{
+  const mesh_corner *c = &owner->corners[3 * face];
+  const vec3& p0 = owner->positions[c[0].v];
+  const vec3& p1 = owner->positions[c[1].v];
+  const vec3& p2 = owner->positions[c[2].v];
+  vec3 dir = r.direction();
+
+  // The largest direction component becomes z, swapping x and y keeps the winding
+  int kz = fabs(dir.x()) > fabs(dir.y()) ? (fabs(dir.x()) > fabs(dir.z()) ? 0 : 2) : (fabs(dir.y()) > fabs(dir.z()) ? 1 : 2);
+  int kx = kz == 2 ? 0 : kz + 1;
+  int ky = kx == 2 ? 0 : kx + 1;
+  if (dir[kz] < 0.0f)
+    std::swap(kx, ky);
+  float sz = 1.0f / dir[kz];
+  float sx = dir[kx] * sz;
+  float sy = dir[ky] * sz;
+
+  vec3 a = p0 - r.origin();
+  vec3 b = p1 - r.origin();
+  vec3 d = p2 - r.origin();
+  float ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+  float bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+  float cx = d[kx] - sx * d[kz], cy = d[ky] - sy * d[kz];
+
+  float u = cx * by - cy * bx;
+  float v = ax * cy - ay * cx;
+  float w = bx * ay - by * ax;
+  // Exactly on an edge, redo the edge functions in double to break the tie consistently
+  if (u == 0.0f || v == 0.0f || w == 0.0f)
+    {
+      u = float((double)cx * by - (double)cy * bx);
+      v = float((double)ax * cy - (double)ay * cx);
+      w = float((double)bx * ay - (double)by * ax);
+    }
+  if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+    return false;
+  float det = u + v + w;
+  if (det == 0.0f)
+    return false;
+
+  float t_scaled = u * (sz * a[kz]) + v * (sz * b[kz]) + w * (sz * d[kz]);
+  t = t_scaled / det;
+  if (!(t > t_min && t < t_max))
+    return false;
+
+  float inv_det = 1.0f / det;
+  b0 = u * inv_det;
+  b1 = v * inv_det;
+  b2 = w * inv_det;
+  return true;
+}
+
+bool mesh_face::occluded(const ray& r, float t_min, float t_max) const
+{
+  local_stats().tests[PRIM_TRIANGLE]++;
+  float t, b0, b1, b2;
+  if (!intersect(r, t_min, t_max, t, b0, b1, b2))
+    return false;
+  local_stats().hits[PRIM_TRIANGLE]++;
+  return true;
+}
+
+bool mesh_face::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+  local_stats().tests[PRIM_TRIANGLE]++;
+  float t, b0, b1, b2;
+  if (!intersect(r, t_min, t_max, t, b0, b1, b2))
+    return false;
+
+  const mesh_corner *c = &owner->corners[3 * face];
+  const vec3& p0 = owner->positions[c[0].v];
+  const vec3& p1 = owner->positions[c[1].v];
+  const vec3& p2 = owner->positions[c[2].v];
+  rec.t = t;
+  // A face cannot tell where the ray leaves the mesh, so glass absorbs nothing inside it
+  rec.t_far = t;
+  rec.p = r.point_at_parameter(t);
+  // Both sides are hit but the normals stay on the counter clockwise side, which
+  // faces out of a closed mesh, so glass can tell a ray leaving it from one entering
+  vec3 geometric = unit_vector(cross(p1 - p0, p2 - p0));
+  if (c[0].vn >= 0 && c[1].vn >= 0 && c[2].vn >= 0)
+    {
+      vec3 n = unit_vector(b0 * owner->normals[c[0].vn] + b1 * owner->normals[c[1].vn] + b2 * owner->normals[c[2].vn]);
+      rec.normal = dot(n, geometric) < 0.0f ? -n : n;
+    }
+  else
+    rec.normal = geometric;
+  if (c[0].vt >= 0 && c[1].vt >= 0 && c[2].vt >= 0)
+    {
+      const float *uv = &owner->uvs[0];
+      rec.u = b0 * uv[2*c[0].vt] + b1 * uv[2*c[1].vt] + b2 * uv[2*c[2].vt];
+      rec.v = b0 * uv[2*c[0].vt + 1] + b1 * uv[2*c[1].vt + 1] + b2 * uv[2*c[2].vt + 1];
+    }
+  else
+    {
+      rec.u = b1;
+      rec.v = b2;
+    }
+  rec.mat_ptr = owner->mat_ptr;
+  local_stats().hits[PRIM_TRIANGLE]++;
+  return true;
+}
+
+#endif
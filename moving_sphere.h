@@ -4,13 +4,16 @@
 #include "vec3.h"
 #include "hitable.h"
 
-class moving_sphere : public hitable
+class moving_sphere final : public hitable
 {
  public:
-  moving_sphere() {}
- moving_sphere(vec3 cen0, vec3 cen1, float t0, float t1, float r, material *m) : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mat_ptr(m) {};
+  moving_sphere() : hitable(HITABLE_MOVING_SPHERE) {}
+ moving_sphere(vec3 cen0, vec3 cen1, float t0, float t1, float r, material *m) : hitable(HITABLE_MOVING_SPHERE), center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mat_ptr(m) {};
 
   virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual bool motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
   vec3 center(float time) const;  
   vec3 center0, center1;
   float time0, time1;
@@ -21,7 +24,9 @@ class moving_sphere : public hitable
 
 bool moving_sphere :: hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-  vec3 oc = r.origin() - center(r.time());
+  local_stats().tests[PRIM_MOVING_SPHERE]++;
+  const vec3 cen = center(r.time());
+  vec3 oc = r.origin() - cen;
   float a = dot(r.direction(), r.direction());
   float b = dot(r.direction(), oc);
   float c = dot(oc, oc) - radius * radius;
@@ -29,22 +34,27 @@ bool moving_sphere :: hit(const ray& r, float t_min, float t_max, hit_record& re
 
   if (discriminant > 0)
     {
-      float temp = (-b - sqrt(discriminant)) / a;
+      float root = sqrt(discriminant);
+      float temp = (-b - root) / a;
       if (temp < t_max && temp > t_min)
 	{
 	  rec.t = temp;
 	  rec.p = r.point_at_parameter(rec.t);
-	  rec.normal = (rec.p - center(r.time())) / radius;
+	  rec.normal = (rec.p - cen) / radius;
+	  rec.u = rec.v = 0.0f;
 	  rec.mat_ptr = mat_ptr;
+	  local_stats().hits[PRIM_MOVING_SPHERE]++;
 	  return true;
 	}
-      temp = (-b + sqrt(discriminant)) / a;
+      temp = (-b + root) / a;
       if (temp < t_max && temp > t_min)
 	{
 	  rec.t = temp;
 	  rec.p = r.point_at_parameter(rec.t);
-	  rec.normal = (rec.p - center(r.time())) / radius;
+	  rec.normal = (rec.p - cen) / radius;
+	  rec.u = rec.v = 0.0f;
 	  rec.mat_ptr = mat_ptr;
+	  local_stats().hits[PRIM_MOVING_SPHERE]++;
 	  return true;	  
 	}
     }
@@ -53,9 +63,49 @@ bool moving_sphere :: hit(const ray& r, float t_min, float t_max, hit_record& re
 }
 
 
+bool moving_sphere :: occluded(const ray& r, float t_min, float t_max) const
+{
+  local_stats().tests[PRIM_MOVING_SPHERE]++;
+  vec3 oc = r.origin() - center(r.time());
+  float a = dot(r.direction(), r.direction());
+  float b = dot(r.direction(), oc);
+  float c = dot(oc, oc) - radius * radius;
+  float discriminant = b*b - a*c;
+  if (discriminant <= 0)
+    return false;
+  float root = sqrt(discriminant);
+  float t_near = (-b - root) / a;
+  float t_far = (-b + root) / a;
+  if ((t_near < t_max && t_near > t_min) || (t_far < t_max && t_far > t_min))
+    {
+      local_stats().hits[PRIM_MOVING_SPHERE]++;
+      return true;
+    }
+  return false;
+}
+
 vec3 moving_sphere :: center(float time) const
 {
   return center0 + ((time - time0) / (time1 - time0))*(center1 - center0);
 }
 
+// Bound the entire sweep of the sphere between the two times
+bool moving_sphere :: bounding_box(float t0, float t1, aabb& box) const
+{
+  vec3 rad(radius, radius, radius);
+  aabb box0(center(t0) - rad, center(t0) + rad);
+  aabb box1(center(t1) - rad, center(t1) + rad);
+  box = surrounding_box(box0, box1);
+  return true;
+}
+
+// The box moves with the centre, so the boxes at the two times bound every time in between exactly
+bool moving_sphere :: motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const
+{
+  vec3 rad(radius, radius, radius);
+  box0 = aabb(center(t0) - rad, center(t0) + rad);
+  box1 = aabb(center(t1) - rad, center(t1) + rad);
+  return true;
+}
+
 #endif
@@ -0,0 +1,64 @@
+#ifndef MOVING_TRIANGLE_H
+#define MOVING_TRIANGLE_H
+
+#include "triangle.h"
+
+/* Triangle whose corners move in straight lines from start[i] at time0 to
+   end[i] at time1. A ray is tested against the triangle where it is at the
+   ray's time. It has no kind of its own and is called through the virtual
+   functions: one more case makes hit_primitive() too large for the compiler
+   to inline into the bvh traversal. */
+class moving_triangle final : public hitable
+{
+ public:
+  moving_triangle() {}
+  moving_triangle(const vec3 start[3], const vec3 end[3], float t0, float t1, material *m);
+
+  virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual bool motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const;
+  triangle at(float time) const;
+
+  vec3 start[3], end[3];
+  float time0, time1;
+  material *mat_ptr;
+};
+
+moving_triangle::moving_triangle(const vec3 s[3], const vec3 e[3], float t0, float t1, material *m)
+  : time0(t0), time1(t1), mat_ptr(m)
+{
+  for (int i = 0; i < 3; ++i)
+    {
+      start[i] = s[i];
+      end[i] = e[i];
+    }
+}
+
+triangle moving_triangle::at(float time) const
+{
+  float s = (time - time0) / (time1 - time0);
+  return triangle(start[0] + s*(end[0] - start[0]), start[1] + s*(end[1] - start[1]), start[2] + s*(end[2] - start[2]), mat_ptr);
+}
+
+bool moving_triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+  return at(r.time()).triangle::hit(r, t_min, t_max, rec);
+}
+
+// Every point of the triangle moves linearly, so the boxes at both ends bound it in between
+bool moving_triangle::motion_bounds(float t0, float t1, aabb& box0, aabb& box1) const
+{
+  at(t0).bounding_box(t0, t0, box0);
+  at(t1).bounding_box(t1, t1, box1);
+  return true;
+}
+
+bool moving_triangle::bounding_box(float t0, float t1, aabb& box) const
+{
+  aabb box1;
+  motion_bounds(t0, t1, box, box1);
+  box.expand(box1);
+  return true;
+}
+
+#endif
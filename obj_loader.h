@@ -0,0 +1,263 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mesh.h"
+#include "tile_scheduler.h"
+#include "arena.h"
+
+/* Wavefront OBJ loader. The file is memory mapped and cut into one chunk per
+   thread at line boundaries. Every thread parses its chunk into local buffers,
+   then the buffers are joined and the face indices shifted by the number of
+   vertices in the chunks before them. Only v, vt, vn and f records are read;
+   polygons are split into triangle fans and everything else (groups,
+   materials, smoothing) is skipped. */
+
+struct obj_chunk
+{
+  std::vector<vec3> positions;
+  std::vector<vec3> normals;
+  std::vector<float> uvs;
+  std::vector<mesh_corner> corners;
+  bool ok;
+};
+
+// Relative (negative) OBJ indices are resolved once the chunk offsets are
+// known. Until then they are stored as OBJ_RELATIVE plus the index local to the
+// chunk, which is negative when it reaches back into an earlier chunk
+const int OBJ_NO_INDEX = -2147483647 - 1;
+const int OBJ_RELATIVE = -(1 << 30);
+
+inline const char *obj_skip_space(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    ++p;
+  return p;
+}
+
+inline const char *obj_next_line(const char *p, const char *end)
+{
+  const char *nl = (const char *)memchr(p, '\n', end - p);
+  return nl ? nl + 1 : end;
+}
+
+// strtof needs a terminated string, so numbers are copied out of the mapping first
+inline const char *obj_parse_float(const char *p, const char *end, float& out)
+{
+  p = obj_skip_space(p, end);
+  char buf[64];
+  int n = 0;
+  while (p < end && n < 63 && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+    buf[n++] = *p++;
+  buf[n] = '\0';
+  out = n > 0 ? strtof(buf, nullptr) : 0.0f;
+  return p;
+}
+
+inline int obj_index(long i, int local_count)
+{
+  if (i > 0)
+    return int(i - 1);
+  if (i < 0 && local_count + i > OBJ_RELATIVE)
+    return OBJ_RELATIVE + int(local_count + i);
+  return OBJ_NO_INDEX;
+}
+
+void obj_parse_chunk(const char *p, const char *end, obj_chunk& chunk)
+{
+  chunk.ok = true;
+  std::vector<mesh_corner> polygon;
+  while (p < end)
+    {
+      const char *line_end = obj_next_line(p, end);
+      p = obj_skip_space(p, line_end);
+      if (line_end - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+	{
+	  float x, y, z;
+	  p = obj_parse_float(p + 1, line_end, x);
+	  p = obj_parse_float(p, line_end, y);
+	  p = obj_parse_float(p, line_end, z);
+	  chunk.positions.push_back(vec3(x, y, z));
+	}
+      else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 'n')
+	{
+	  float x, y, z;
+	  p = obj_parse_float(p + 2, line_end, x);
+	  p = obj_parse_float(p, line_end, y);
+	  p = obj_parse_float(p, line_end, z);
+	  chunk.normals.push_back(vec3(x, y, z));
+	}
+      else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 't')
+	{
+	  float u, v;
+	  p = obj_parse_float(p + 2, line_end, u);
+	  p = obj_parse_float(p, line_end, v);
+	  chunk.uvs.push_back(u);
+	  chunk.uvs.push_back(v);
+	}
+      else if (line_end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+	{
+	  // Corners are v, v/vt, v//vn or v/vt/vn
+	  polygon.clear();
+	  ++p;
+	  while (true)
+	    {
+	      p = obj_skip_space(p, line_end);
+	      if (p >= line_end || *p == '\n' || *p == '#')
+		break;
+	      char *next;
+	      mesh_corner c;
+	      c.v = obj_index(strtol(p, &next, 10), (int)chunk.positions.size());
+	      c.vt = c.vn = OBJ_NO_INDEX;
+	      if (next == p)
+		{
+		  chunk.ok = false;
+		  break;
+		}
+	      p = next;
+	      if (p < line_end && *p == '/')
+		{
+		  ++p;
+		  if (p < line_end && *p != '/')
+		    {
+		      c.vt = obj_index(strtol(p, &next, 10), (int)chunk.uvs.size() / 2);
+		      p = next;
+		    }
+		  if (p < line_end && *p == '/')
+		    {
+		      c.vn = obj_index(strtol(p + 1, &next, 10), (int)chunk.normals.size());
+		      p = next;
+		    }
+		}
+	      polygon.push_back(c);
+	    }
+	  for (size_t i = 2; i < polygon.size(); ++i)
+	    {
+	      chunk.corners.push_back(polygon[0]);
+	      chunk.corners.push_back(polygon[i - 1]);
+	      chunk.corners.push_back(polygon[i]);
+	    }
+	}
+      p = line_end;
+    }
+}
+
+// Turns a chunk local index into an index into the joined buffers
+inline int obj_resolve(int i, int offset, int count)
+{
+  if (i == OBJ_NO_INDEX)
+    return -1;
+  if (i < 0)
+    i = offset + (i - OBJ_RELATIVE);
+  return i >= 0 && i < count ? i : -1;
+}
+
+// The mesh is made in the arena a. Returns nullptr if the file cannot be read or has no faces
+mesh *load_obj(const std::string& file_name, material *mat, arena& a, int threads = 0)
+{
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+    {
+      std::cerr << "Cannot open " << file_name << std::endl;
+      return nullptr;
+    }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+      close(fd);
+      std::cerr << "Cannot read " << file_name << std::endl;
+      return nullptr;
+    }
+  size_t size = (size_t)st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    {
+      std::cerr << "Cannot map " << file_name << std::endl;
+      return nullptr;
+    }
+  madvise(map, size, MADV_SEQUENTIAL);
+  const char *begin = (const char *)map;
+  const char *end = begin + size;
+
+  // Small files are not worth the threads
+  int num_chunks = threads > 0 ? threads : default_thread_count();
+  num_chunks = std::max(1, std::min(num_chunks, int(size / (1 << 20)) + 1));
+  std::vector<const char *> bounds(num_chunks + 1);
+  bounds[0] = begin;
+  for (int i = 1; i < num_chunks; ++i)
+    bounds[i] = std::max(bounds[i - 1], obj_next_line(begin + size * i / num_chunks, end));
+  bounds[num_chunks] = end;
+
+  std::vector<obj_chunk> chunks(num_chunks);
+  std::vector<std::thread> workers;
+  for (int i = 1; i < num_chunks; ++i)
+    workers.push_back(std::thread(obj_parse_chunk, bounds[i], bounds[i + 1], std::ref(chunks[i])));
+  obj_parse_chunk(bounds[0], bounds[1], chunks[0]);
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  munmap(map, size);
+
+  mesh *m = a.make<mesh>();
+  m->mat_ptr = mat;
+  size_t np = 0, nn = 0, nt = 0, nc = 0;
+  for (int i = 0; i < num_chunks; ++i)
+    {
+      if (!chunks[i].ok)
+	std::cerr << "Skipped malformed faces in " << file_name << std::endl;
+      np += chunks[i].positions.size();
+      nn += chunks[i].normals.size();
+      nt += chunks[i].uvs.size();
+      nc += chunks[i].corners.size();
+    }
+  m->positions.reserve(np);
+  m->normals.reserve(nn);
+  m->uvs.reserve(nt);
+  m->corners.reserve(nc);
+
+  for (int i = 0; i < num_chunks; ++i)
+    {
+      obj_chunk& chunk = chunks[i];
+      int v_offset = (int)m->positions.size();
+      int vn_offset = (int)m->normals.size();
+      int vt_offset = (int)m->uvs.size() / 2;
+      for (size_t k = 0; k + 2 < chunk.corners.size(); k += 3)
+	{
+	  mesh_corner c[3];
+	  bool valid = true;
+	  for (int j = 0; j < 3; ++j)
+	    {
+	      c[j].v = obj_resolve(chunk.corners[k + j].v, v_offset, (int)np);
+	      c[j].vt = obj_resolve(chunk.corners[k + j].vt, vt_offset, (int)nt / 2);
+	      c[j].vn = obj_resolve(chunk.corners[k + j].vn, vn_offset, (int)nn);
+	      valid = valid && c[j].v >= 0;
+	    }
+	  if (valid)
+	    m->corners.insert(m->corners.end(), c, c + 3);
+	}
+      m->positions.insert(m->positions.end(), chunk.positions.begin(), chunk.positions.end());
+      m->normals.insert(m->normals.end(), chunk.normals.begin(), chunk.normals.end());
+      m->uvs.insert(m->uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+      std::vector<mesh_corner>().swap(chunk.corners);
+    }
+
+  if (m->num_faces() == 0)
+    {
+      // The empty mesh is freed with the arena
+      std::cerr << "No faces in " << file_name << std::endl;
+      return nullptr;
+    }
+  m->build();
+  return m;
+}
+
+#endif
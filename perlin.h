@@ -1,12 +1,159 @@
 #ifndef PERLINH
 #define PERLINH
 
+#include <math.h>
+#include <stdint.h>
+#include <utility>
+#include "vec3.h"
+#include "random.h"
+#include "simd.h"
+
+/* Gradient noise over tables of 256 random unit gradients and three random
+   permutations, which hash the corners of the integer lattice into the
+   gradients. The tables are filled from the seed alone, so every process of a
+   distributed or resumed render sees the same noise. noise() has a SIMD_WIDTH
+   wide version: the corners are hashed lane by lane, the gradients gathered
+   with one load per lane and corner, and the dot products, fades and
+   interpolation made for all lanes at once. turb() uses it to evaluate its
+   octaves together. */
 class perlin
 {
  public:
+  explicit perlin(uint64_t seed = 0);
+
+  // In about [-1, 1], 0 on every lattice point
+  float noise(const vec3& p) const;
+  vfloat noise(vfloat x, vfloat y, vfloat z) const;
+  // Sum of |noise| over depth octaves, each twice the frequency and half the weight of the last
+  float turb(const vec3& p, int depth = 7) const;
+
+ private:
+  static const int TABLE_SIZE = 256;
+
+  // Gradient indices of the eight corners of cell i j k, corner c is offset by its bits: 1 along x, 2 along y, 4 along z
+  void hash_corners(int i, int j, int k, int *h, int stride) const
+  {
+    int x[2] = { perm_x[i & 255], perm_x[(i + 1) & 255] };
+    int y[2] = { perm_y[j & 255], perm_y[(j + 1) & 255] };
+    int z[2] = { perm_z[k & 255], perm_z[(k + 1) & 255] };
+    for (int c = 0; c < 8; ++c)
+      h[c * stride] = x[c & 1] ^ y[(c >> 1) & 1] ^ z[c >> 2];
+  }
 
+  alignas(16) float grad[TABLE_SIZE][4];  // x y z and padding, so a gradient is one aligned load
+  unsigned char perm_x[TABLE_SIZE], perm_y[TABLE_SIZE], perm_z[TABLE_SIZE];
 };
 
+perlin::perlin(uint64_t seed)
+{
+  rng gen(seed);
+  for (int i = 0; i < TABLE_SIZE; ++i)
+    {
+      // Uniform on the sphere: pick inside the unit ball and project
+      vec3 g;
+      do
+	g = vec3(2.0f * gen.next_float() - 1.0f, 2.0f * gen.next_float() - 1.0f, 2.0f * gen.next_float() - 1.0f);
+      while (g.squared_length() > 1.0f || g.squared_length() < 1e-4f);
+      g = unit_vector(g);
+      grad[i][0] = g.x();
+      grad[i][1] = g.y();
+      grad[i][2] = g.z();
+      grad[i][3] = 0.0f;
+    }
+  unsigned char *perms[3] = { perm_x, perm_y, perm_z };
+  for (int a = 0; a < 3; ++a)
+    {
+      unsigned char *perm = perms[a];
+      for (int i = 0; i < TABLE_SIZE; ++i)
+	perm[i] = (unsigned char)i;
+      for (int i = TABLE_SIZE - 1; i > 0; --i)
+	std::swap(perm[i], perm[gen.next_uint() % (i + 1)]);
+    }
+}
+
+// 6t^5 - 15t^4 + 10t^3, flat first and second derivatives at the lattice points
+inline float perlin_fade(float t) { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); }
+inline vfloat perlin_fade(vfloat t) { return t * t * t * (t * (t * vfloat(6.0f) - vfloat(15.0f)) + vfloat(10.0f)); }
+
+float perlin::noise(const vec3& p) const
+{
+  float fx = floorf(p.x()), fy = floorf(p.y()), fz = floorf(p.z());
+  float u = p.x() - fx, v = p.y() - fy, w = p.z() - fz;
+  int i = (int)fx, j = (int)fy, k = (int)fz;
+
+  int h[8];
+  hash_corners(i, j, k, h, 1);
+  float d[8];
+  for (int c = 0; c < 8; ++c)
+    {
+      const float *g = grad[h[c]];
+      d[c] = g[0] * (u - (c & 1)) + g[1] * (v - ((c >> 1) & 1)) + g[2] * (w - (c >> 2));
+    }
+  float su = perlin_fade(u), sv = perlin_fade(v), sw = perlin_fade(w);
+  float x00 = d[0] + su * (d[1] - d[0]), x10 = d[2] + su * (d[3] - d[2]);
+  float x01 = d[4] + su * (d[5] - d[4]), x11 = d[6] + su * (d[7] - d[6]);
+  float y0 = x00 + sv * (x10 - x00), y1 = x01 + sv * (x11 - x01);
+  return y0 + sw * (y1 - y0);
+}
+
+vfloat perlin::noise(vfloat x, vfloat y, vfloat z) const
+{
+  vfloat fx = vfloor(x), fy = vfloor(y), fz = vfloor(z);
+  vfloat u = x - fx, v = y - fy, w = z - fz;
+  alignas(32) float cx[SIMD_WIDTH], cy[SIMD_WIDTH], cz[SIMD_WIDTH];
+  fx.store(cx);
+  fy.store(cy);
+  fz.store(cz);
 
+  int h[8][SIMD_WIDTH];
+  for (int l = 0; l < SIMD_WIDTH; ++l)
+    hash_corners((int)cx[l], (int)cy[l], (int)cz[l], &h[0][l], SIMD_WIDTH);
+
+  const vfloat one(1.0f);
+  vfloat d[8];
+  for (int c = 0; c < 8; ++c)
+    {
+      vfloat gx, gy, gz;
+      gather3(&grad[0][0], h[c], gx, gy, gz);
+      vfloat ou = (c & 1) ? u - one : u;
+      vfloat ov = (c & 2) ? v - one : v;
+      vfloat ow = (c & 4) ? w - one : w;
+      d[c] = gx * ou + gy * ov + gz * ow;
+    }
+  vfloat su = perlin_fade(u), sv = perlin_fade(v), sw = perlin_fade(w);
+  vfloat x00 = d[0] + su * (d[1] - d[0]), x10 = d[2] + su * (d[3] - d[2]);
+  vfloat x01 = d[4] + su * (d[5] - d[4]), x11 = d[6] + su * (d[7] - d[6]);
+  vfloat y0 = x00 + sv * (x10 - x00), y1 = x01 + sv * (x11 - x01);
+  return y0 + sw * (y1 - y0);
+}
+
+float perlin::turb(const vec3& p, int depth) const
+{
+  alignas(32) float px[SIMD_WIDTH], py[SIMD_WIDTH], pz[SIMD_WIDTH], weight[SIMD_WIDTH];
+  alignas(32) float sum[SIMD_WIDTH];
+  vfloat total(0.0f);
+  float scale = 1.0f;
+  for (int octave = 0; octave < depth; octave += SIMD_WIDTH)
+    {
+      // Lanes past the last octave get weight 0
+      for (int l = 0; l < SIMD_WIDTH; ++l)
+	{
+	  bool used = octave + l < depth;
+	  px[l] = scale * p.x();
+	  py[l] = scale * p.y();
+	  pz[l] = scale * p.z();
+	  weight[l] = used ? 1.0f / scale : 0.0f;
+	  if (used)
+	    scale *= 2.0f;
+	}
+      vfloat n = noise(vfloat::load(px), vfloat::load(py), vfloat::load(pz));
+      total = total + vfloat::load(weight) * vmax(n, -n);
+    }
+  total.store(sum);
+  float result = 0.0f;
+  for (int l = 0; l < SIMD_WIDTH; ++l)
+    result += sum[l];
+  return result;
+}
 
 #endif
@@ -5,13 +5,16 @@
 #include "vec3.h"
 #include "hitable.h"
 
-class plane : public hitable
+class plane final : public hitable
 {
  public:
-  plane() {}
- plane(vec3 cen, float w, float h, vec3 n, material *m) : center(cen), width(w), height(h), norm(n), mat_ptr(m) {};
+  plane() : hitable(HITABLE_PLANE) {}
+ plane(vec3 cen, float w, float h, vec3 n, material *m) : hitable(HITABLE_PLANE), center(cen), width(w), height(h), norm(n), mat_ptr(m) {};
   
   virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const { return false; } // hit() treats the plane as infinite
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
 
   vec3 center;
   vec3 norm;
@@ -22,6 +25,7 @@ class plane : public hitable
 
 bool plane::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+  local_stats().tests[PRIM_PLANE]++;
   if (dot(r.direction(), norm) > 1e-6)
     {
       float numerator = dot(center - r.origin(), norm);
@@ -34,7 +38,9 @@ bool plane::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 	  rec.p = r.point_at_parameter(rec.t);
 
 	  rec.normal = norm;
+	  rec.u = rec.v = 0.0f;
 	  rec.mat_ptr = mat_ptr;
+	  local_stats().hits[PRIM_PLANE]++;
 	  return true;
 	}
     }
@@ -42,4 +48,58 @@ bool plane::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
   return false;
 }
 
+bool plane::occluded(const ray& r, float t_min, float t_max) const
+{
+  local_stats().tests[PRIM_PLANE]++;
+  float denominator = dot(r.direction(), norm);
+  if (denominator > 1e-6)
+    {
+      float t = dot(center - r.origin(), norm) / denominator;
+      if (t < t_max && t > t_min)
+	{
+	  local_stats().hits[PRIM_PLANE]++;
+	  return true;
+	}
+    }
+  return false;
+}
+
+void plane::hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const
+{
+  local_stats().tests[PRIM_PLANE] += rp.size;
+  const vfloat nx(norm.x()), ny(norm.y()), nz(norm.z());
+  const vfloat cx(center.x()), cy(center.y()), cz(center.z());
+  const vfloat tmin(t_min), eps(1e-6f);
+  for (int k = 0; k < rp.size; k += SIMD_WIDTH)
+    {
+      vfloat denominator = vfloat::load(rp.dx + k)*nx + vfloat::load(rp.dy + k)*ny + vfloat::load(rp.dz + k)*nz;
+      vmask facing = denominator > eps;
+      if (!any(facing))
+	continue;
+      vfloat numerator = (cx - vfloat::load(rp.ox + k))*nx + (cy - vfloat::load(rp.oy + k))*ny + (cz - vfloat::load(rp.oz + k))*nz;
+      vfloat t = numerator / denominator;
+      int mask = movemask(facing & (t < vfloat::load(hits.t + k)) & (t > tmin));
+      if (!mask)
+	continue;
+
+      alignas(32) float tt[SIMD_WIDTH];
+      t.store(tt);
+      for (int l = 0; l < SIMD_WIDTH; ++l)
+	{
+	  if (!(mask & (1 << l)))
+	    continue;
+	  int i = k + l;
+	  hit_record& rec = hits.rec[i];
+	  rec.t = tt[l];
+	  rec.p = rp.get(i).point_at_parameter(rec.t);
+	  rec.normal = norm;
+	  rec.u = rec.v = 0.0f;
+	  rec.mat_ptr = mat_ptr;
+	  hits.t[i] = rec.t;
+	  hits.hit[i] = true;
+	  local_stats().hits[PRIM_PLANE]++;
+	}
+    }
+}
+
 #endif
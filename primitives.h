@@ -0,0 +1,51 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "triangle.h"
+#include "quad.h"
+#include "plane.h"
+#include "sphere_set.h"
+#include "mesh.h"
+
+/* The bvh leaves and the occluder cache test every primitive through these,
+   so the built in primitives are called directly, where they can be inlined,
+   instead of through the vtable. The primitives are final, which keeps a
+   subclass from inheriting a kind it does not implement. */
+
+inline bool hit_primitive(const hitable *h, const ray& r, float t_min, float t_max, hit_record& rec)
+{
+  switch (h->kind)
+    {
+    case HITABLE_SPHERE: return static_cast<const sphere *>(h)->sphere::hit(r, t_min, t_max, rec);
+    case HITABLE_MOVING_SPHERE: return static_cast<const moving_sphere *>(h)->moving_sphere::hit(r, t_min, t_max, rec);
+    case HITABLE_TRIANGLE: return static_cast<const triangle *>(h)->triangle::hit(r, t_min, t_max, rec);
+    case HITABLE_QUAD: return static_cast<const quad *>(h)->quad::hit(r, t_min, t_max, rec);
+    case HITABLE_PLANE: return static_cast<const plane *>(h)->plane::hit(r, t_min, t_max, rec);
+    case HITABLE_SPHERE_SET: return static_cast<const sphere_set *>(h)->sphere_set::hit(r, t_min, t_max, rec);
+    case HITABLE_MESH_FACE: return static_cast<const mesh_face *>(h)->mesh_face::hit(r, t_min, t_max, rec);
+    default: return h->hit(r, t_min, t_max, rec);
+    }
+}
+
+inline bool occluded_primitive(const hitable *h, const ray& r, float t_min, float t_max)
+{
+  switch (h->kind)
+    {
+    case HITABLE_SPHERE: return static_cast<const sphere *>(h)->sphere::occluded(r, t_min, t_max);
+    case HITABLE_MOVING_SPHERE: return static_cast<const moving_sphere *>(h)->moving_sphere::occluded(r, t_min, t_max);
+    case HITABLE_TRIANGLE:
+      {
+	hit_record rec;
+	return static_cast<const triangle *>(h)->triangle::hit(r, t_min, t_max, rec);
+      }
+    case HITABLE_QUAD: return static_cast<const quad *>(h)->quad::occluded(r, t_min, t_max);
+    case HITABLE_PLANE: return static_cast<const plane *>(h)->plane::occluded(r, t_min, t_max);
+    case HITABLE_SPHERE_SET: return static_cast<const sphere_set *>(h)->sphere_set::occluded(r, t_min, t_max);
+    case HITABLE_MESH_FACE: return static_cast<const mesh_face *>(h)->mesh_face::occluded(r, t_min, t_max);
+    default: return h->occluded(r, t_min, t_max);
+    }
+}
+
+#endif
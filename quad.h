@@ -0,0 +1,112 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include <math.h>
+#include "vec3.h"
+#include "random.h"
+#include "hitable.h"
+
+/* Parallelogram with corner q and edges u and v. The normal is
+   unit(cross(u, v)), which is the side an emissive quad lights. */
+class quad final : public hitable
+{
+ public:
+  quad() : hitable(HITABLE_QUAD) {}
+ quad(vec3 _q, vec3 _u, vec3 _v, material *m) : hitable(HITABLE_QUAD), q(_q), u(_u), v(_v), mat_ptr(m)
+  {
+    vec3 n = cross(u, v);
+    area = n.length();
+    norm = n / area;
+    w = n / dot(n, n);
+    d = dot(norm, q);
+  }
+
+  virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
+  virtual float pdf_value(const vec3& o, const vec3& dir) const;
+  virtual vec3 random(const vec3& o) const;
+
+  vec3 q, u, v;
+  vec3 norm;
+  vec3 w;       // cross(u, v) / |cross(u, v)|^2, turns a point in the plane into edge coordinates
+  float d;      // plane offset along the normal
+  float area;
+  material *mat_ptr;
+
+ private:
+  bool intersect(const ray& r, float t_min, float t_max, float& t, float& a, float& b) const;
+};
+
+bool quad::intersect(const ray& r, float t_min, float t_max, float& t, float& a, float& b) const
+{
+  float denominator = dot(norm, r.direction());
+  if (fabs(denominator) < 1e-8f)
+    return false;
+  t = (d - dot(norm, r.origin())) / denominator;
+  if (!(t > t_min && t < t_max))
+    return false;
+  vec3 planar = r.point_at_parameter(t) - q;
+  a = dot(w, cross(planar, v));
+  b = dot(w, cross(u, planar));
+  return a >= 0.0f && a <= 1.0f && b >= 0.0f && b <= 1.0f;
+}
+
+bool quad::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+  local_stats().tests[PRIM_QUAD]++;
+  float t, a, b;
+  if (!intersect(r, t_min, t_max, t, a, b))
+    return false;
+  rec.t = t;
+  rec.t_far = t;  // flat, nothing to absorb
+  rec.p = r.point_at_parameter(t);
+  rec.normal = norm;
+  rec.u = a;
+  rec.v = b;
+  rec.mat_ptr = mat_ptr;
+  local_stats().hits[PRIM_QUAD]++;
+  return true;
+}
+
+bool quad::occluded(const ray& r, float t_min, float t_max) const
+{
+  local_stats().tests[PRIM_QUAD]++;
+  float t, a, b;
+  if (!intersect(r, t_min, t_max, t, a, b))
+    return false;
+  local_stats().hits[PRIM_QUAD]++;
+  return true;
+}
+
+bool quad::bounding_box(float t0, float t1, aabb& box) const
+{
+  box = aabb();
+  box.expand(q);
+  box.expand(q + u);
+  box.expand(q + v);
+  box.expand(q + u + v);
+  // Axis aligned quads would have a flat box
+  vec3 pad(1e-4f, 1e-4f, 1e-4f);
+  box = aabb(box.min() - pad, box.max() + pad);
+  return true;
+}
+
+// Points are picked uniformly by area, converted here to a density per solid angle
+float quad::pdf_value(const vec3& o, const vec3& dir) const
+{
+  float t, a, b;
+  if (!intersect(ray(o, dir, 0.0f), 0.001f, FLT_MAX, t, a, b))
+    return 0.0f;
+  float dist2 = t * t * dir.squared_length();
+  float cosine = fabs(dot(dir, norm)) / dir.length();
+  return cosine > 0.0f ? dist2 / (cosine * area) : 0.0f;
+}
+
+vec3 quad::random(const vec3& o) const
+{
+  float a = random_float(), b = random_float();
+  return q + a * u + b * v - o;
+}
+
+#endif
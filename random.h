@@ -0,0 +1,68 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+/* Counter based random numbers. Every value is a hash of a 64 bit key and a
+   running counter, so a generator is just two integers and no state is shared
+   between threads. Render threads key their generator by pixel, sample and
+   bounce, which makes an image independent of how many threads rendered it and
+   in which order the tiles were picked up. */
+
+// Global seed mixed into every sample key, so a whole render can be re-rolled
+uint64_t RENDER_SEED = 0;
+
+// SplitMix64 finalizer
+inline uint64_t mix64(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+inline uint64_t hash_combine(uint64_t a, uint64_t b)
+{
+  return mix64(a ^ (b + 0x9e3779b97f4a7c15ULL + (a << 6) + (a >> 2)));
+}
+
+class rng
+{
+ public:
+ rng() : key(0), counter(0) {}
+ explicit rng(uint64_t seed) : key(mix64(seed)), counter(0) {}
+ rng(uint64_t a, uint64_t b, uint64_t c) : key(hash_combine(hash_combine(mix64(a), b), c)), counter(0) {}
+
+  inline uint64_t next_u64() { return mix64(key + (++counter) * 0x9e3779b97f4a7c15ULL); }
+  inline uint32_t next_uint() { return uint32_t(next_u64() >> 32); }
+  // Uniform in [0, 1) using the top 24 bits, so the result never rounds up to 1
+  inline float next_float() { return float(next_u64() >> 40) * (1.0f / 16777216.0f); }
+
+  uint64_t key;
+  uint64_t counter;
+};
+
+// Generator used by the render thread for the current path
+thread_local rng THREAD_RNG;
+thread_local uint64_t THREAD_PATH_KEY = 0;
+
+// Start a new camera sample. The camera draws from stream 0 of the path
+inline void begin_sample(uint64_t pixel, uint64_t sample)
+{
+  THREAD_PATH_KEY = hash_combine(hash_combine(mix64(RENDER_SEED), pixel), sample);
+  THREAD_RNG.key = THREAD_PATH_KEY;
+  THREAD_RNG.counter = 0;
+}
+
+// Switch to the stream of the given bounce, independent of how many numbers earlier bounces consumed
+inline void begin_bounce(int depth)
+{
+  THREAD_RNG.key = hash_combine(THREAD_PATH_KEY, uint64_t(depth + 1));
+  THREAD_RNG.counter = 0;
+}
+
+inline float random_float()
+{
+  return THREAD_RNG.next_float();
+}
+
+#endif
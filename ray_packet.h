@@ -0,0 +1,48 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <cfloat>
+#include "ray.h"
+#include "simd.h"
+
+// Largest packet the renderer traces, a multiple of every SIMD width
+const int MAX_PACKET = 16;
+
+/* Up to MAX_PACKET coherent rays stored as structure of arrays, so SIMD_WIDTH
+   rays can be loaded into one register per component. Lanes past size are
+   padding and never report a hit. */
+struct ray_packet
+{
+  void set(int i, const ray& r)
+  {
+    ox[i] = r.A.x(); oy[i] = r.A.y(); oz[i] = r.A.z();
+    dx[i] = r.B.x(); dy[i] = r.B.y(); dz[i] = r.B.z();
+    idx[i] = 1.0f / dx[i]; idy[i] = 1.0f / dy[i]; idz[i] = 1.0f / dz[i];
+    time[i] = r._time;
+  }
+  ray get(int i) const { return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]), time[i]); }
+  // Number of lanes that need to be processed, rounded up to whole vectors
+  int lanes() const { return (size + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH; }
+
+  int size;
+  alignas(32) float ox[MAX_PACKET];
+  alignas(32) float oy[MAX_PACKET];
+  alignas(32) float oz[MAX_PACKET];
+  alignas(32) float dx[MAX_PACKET];
+  alignas(32) float dy[MAX_PACKET];
+  alignas(32) float dz[MAX_PACKET];
+  alignas(32) float idx[MAX_PACKET];  // reciprocal directions for the slab test
+  alignas(32) float idy[MAX_PACKET];
+  alignas(32) float idz[MAX_PACKET];
+  alignas(32) float time[MAX_PACKET];
+};
+
+// Fill the padding lanes with copies of the first ray so they hold valid numbers
+inline void pad_packet(ray_packet& rp)
+{
+  ray first = rp.get(0);
+  for (int i = rp.size; i < MAX_PACKET; ++i)
+    rp.set(i, first);
+}
+
+#endif
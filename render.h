@@ -0,0 +1,383 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+/* The integrator and the tile tracer, shared by the renderer in main.cpp and
+   the benchmarks in bench.cpp. Both render into CANVAS with SETTINGS. */
+
+#include <iostream>
+#include <cfloat>
+#include <algorithm>
+#include <stdlib.h>
+// Defined primitive shapes
+#include "sphere.h"
+#include "plane.h"
+#include "triangle.h"
+#include "moving_sphere.h"
+
+#include "hitable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "all_scenes.h"
+#include "framebuffer.h"
+#include "render_settings.h"
+
+# define M_PI  3.14159265358979323846  /* pi */
+
+// Resolution, sampling, lighting mode and scene are all chosen on the command line, see render_settings.h
+render_settings SETTINGS;
+
+// Linear color of every pixel, streamed out to SETTINGS.output as rows complete
+framebuffer CANVAS;
+
+float SPEC_STRENGTH = 0.090f;
+
+// Shadow ray towards the point light, taken at the time of the ray that found rec so moving objects blur their shadows too
+ray shadowRay(const scene& sc, const hit_record& rec, float time)
+{
+    const vec3& lightPos = sc.light_pos;
+    if (SETTINGS.shadow_depth > 1)
+        return ray(rec.p, unit_vector((lightPos - rec.p) + 0.1*random_in_unit_sphere()), time); // Project ray to light with slight offset to make shadows more soft
+    else
+        return ray(rec.p, unit_vector(lightPos - rec.p), time); // No offset for hard-shadows
+}
+
+bool shadowBlocked(const scene& sc, const ray& lightDir)
+{
+    local_stats().shadow_rays++;
+    // Whatever blocked the previous shadow ray on this thread is the most likely blocker
+    if (LAST_OCCLUDER && occluded_primitive(LAST_OCCLUDER, lightDir, 0.001f, FLT_MAX))
+    {
+        local_stats().occluder_cache_hits++;
+        return true;
+    }
+    return sc.world->occluded(lightDir, 0.001f, FLT_MAX);
+}
+
+bool shadow(const scene& sc, const hit_record& rec, float time)
+{
+    return shadowBlocked(sc, shadowRay(sc, rec, time));
+}
+
+// Shade and specular highlight at rec once count of its shadow rays were blocked
+vec3 shadowShade(const scene& sc, const hit_record& rec, int count, float& spec)
+{
+    vec3 shade(0.3f, 0.3f, 0.3f);
+    vec3 nonshade(1.0f, 1.0f, 1.0f);
+    // Compute specular highlight
+    spec = 0.0f;
+    if (count == 0) {
+        vec3 viewDir = unit_vector(sc.lookfrom - rec.p);
+        vec3 lightDir = unit_vector(sc.light_pos - rec.p);
+        vec3 reflectDir = reflect(-lightDir, rec.normal);
+        spec = SPEC_STRENGTH * std::pow(std::max(dot(viewDir, reflectDir), 0.0f), 16);
+        //  spec *= (1.0f - float(count))/float(SHADOW_DEPTH);
+    }
+    return nonshade - (nonshade - shade)*(float(count) / float(SETTINGS.shadow_depth));
+}
+
+vec3 softShadow(const scene& sc, const hit_record& rec, float time, float& spec)
+{
+    int count = 0; // Total number of shadow rays that intersected an object in the scene
+    for (int depth = 0; depth < SETTINGS.shadow_depth; ++depth)
+    {
+        if (shadow(sc, rec, time))
+            count++;
+    }
+    return shadowShade(sc, rec, count, spec);
+}
+
+vec3 sky(const ray& r)
+{
+    vec3 unit_direction = unit_vector(r.direction());
+    float t = 0.5f*(unit_direction.y() + 1.0f);
+    return (1.0f - t)*vec3(1.0f, 1.0f, 1.0f) + t*vec3(0.5f, 0.7f, 1.0f);
+}
+
+// Weight of a sample taken with density pdf_a when pdf_b could have produced it too (Veach's power heuristic)
+inline float power_heuristic(float pdf_a, float pdf_b)
+{
+    float a = pdf_a*pdf_a;
+    float b = pdf_b*pdf_b;
+    return a / (a + b);
+}
+
+// Solid angle density with which directLight() picks direction v from o
+float lightPdf(const scene& sc, const vec3& o, const vec3& v)
+{
+    float pdf = 0.0f;
+    for (size_t i = 0; i < sc.lights.size(); ++i)
+        pdf += sc.lights[i]->pdf_value(o, v);
+    return pdf / sc.lights.size();
+}
+
+/* Next event estimation: pick one light uniformly, sample a direction towards
+   it by solid angle and add its contribution if nothing is in the way,
+   weighted against the chance that scattering would have found the same light.
+   sampleLight() does all but the shadow test: it returns false if the sample
+   adds nothing, otherwise contribution counts if toLight is clear up to t_max. */
+bool sampleLight(const scene& sc, const ray& r_in, const hit_record& rec, ray& toLight, float& t_max, vec3& contribution)
+{
+    const int n = (int)sc.lights.size();
+    const hitable *light = sc.lights[std::min(int(random_float()*n), n - 1)];
+    toLight = ray(rec.p, light->random(rec.p), r_in.time());
+    hit_record lightRec;
+    if (!light->hit(toLight, 0.001f, FLT_MAX, lightRec))
+        return false;
+    float light_pdf = light->pdf_value(rec.p, toLight.direction()) / n;
+    vec3 f = material_eval(rec.mat_ptr, r_in, rec, toLight.direction());
+    vec3 le = material_emitted(lightRec.mat_ptr, toLight, lightRec);
+    if (light_pdf <= 0.0f || is_black(f) || is_black(le))
+        return false;
+
+    float weight = power_heuristic(light_pdf, material_pdf(rec.mat_ptr, r_in, rec, toLight.direction()));
+    contribution = f*le*(weight / light_pdf);
+    t_max = lightRec.t*0.999f;
+    return true;
+}
+
+vec3 directLight(const scene& sc, const ray& r_in, const hit_record& rec)
+{
+    ray toLight;
+    float t_max;
+    vec3 contribution;
+    if (!sampleLight(sc, r_in, rec, toLight, t_max, contribution))
+        return vec3(0.0f, 0.0f, 0.0f);
+    local_stats().shadow_rays++;
+    if (sc.world->occluded(toLight, 0.001f, t_max))
+        return vec3(0.0f, 0.0f, 0.0f);
+    return contribution;
+}
+
+/* Follows one path from the camera with a loop instead of recursion, carrying
+   the product of all attenuations so far as the path throughput. Past
+   SETTINGS.roulette bounces a path survives every further bounce with a
+   probability equal to its largest throughput channel, and the survivors are
+   divided by that probability, so the estimate stays unbiased while dim paths
+   stop early. In global mode the scene's area lights are sampled at every
+   diffuse bounce, and emitters found by scattering are weighted against that
+   with multiple importance sampling. The integrator is specialised on the
+   lighting mode, so every mode gets its own copy of the hot loop with the
+   unused lighting terms compiled out. The closest hit of the camera ray is
+   passed in, since it may come from a packet. */
+template <lighting_mode MODE>
+vec3 radiance(ray r, bool hit, hit_record rec, const scene& sc)
+{
+    const hitable *world = sc.world;
+    const bool sampleLights = MODE == LIGHT_GLOBAL && !sc.lights.empty();
+    vec3 result(0.0f, 0.0f, 0.0f);
+    vec3 throughput(1.0f, 1.0f, 1.0f);
+    float scatter_pdf = 0.0f;  // density r was scattered with, 0 for camera rays and specular bounces
+    for (int depth = 0; ; ++depth)
+    {
+        if (depth > 0)
+        {
+            begin_bounce(depth);
+            local_stats().secondary_rays++;
+            hit = world->hit(r, 0.001f, FLT_MAX, rec);
+        }
+        if (!hit)
+        {
+            count_path_depth(depth);
+            return sc.sky ? result + throughput*sky(r) : result;
+        }
+
+        vec3 emitted = material_emitted(rec.mat_ptr, r, rec);
+        if (!is_black(emitted))
+        {
+            float weight = 1.0f;
+            if (sampleLights && scatter_pdf > 0.0f)
+                weight = power_heuristic(scatter_pdf, lightPdf(sc, r.origin(), r.direction()));
+            result += throughput*emitted*weight;
+        }
+        const bool diffuse = material_is_diffuse(rec.mat_ptr);
+        if (sampleLights && diffuse && depth < SETTINGS.depth)
+            result += throughput*directLight(sc, r, rec);
+
+        float spec = 0.0f;  // Specular coefficient
+        // check if area should be shadowed
+        vec3 shade(1.0f, 1.0f, 1.0f);
+        if (MODE == LIGHT_SHADOWS)
+            shade = softShadow(sc, rec, r.time(), spec);
+
+        ray scattered;
+        vec3 attenuation;
+        if (depth >= SETTINGS.depth || !material_scatter(rec.mat_ptr, r, rec, attenuation, scattered, sc.light_pos))
+        {
+            count_path_depth(depth);
+            return result;
+        }
+        if (MODE == LIGHT_SHADOWS)
+        {
+            result += throughput*spec;
+            throughput *= shade;
+        }
+        throughput *= attenuation;
+        scatter_pdf = diffuse ? material_pdf(rec.mat_ptr, r, rec, scattered.direction()) : 0.0f;
+
+        if (SETTINGS.roulette > 0 && depth + 1 >= SETTINGS.roulette)
+        {
+            float survive = std::min(std::max(throughput.x(), std::max(throughput.y(), throughput.z())), 0.95f);
+            if (!(random_float() < survive))
+            {
+                count_path_depth(depth);
+                return result;
+            }
+            throughput /= survive;
+        }
+        r = scattered;
+    }
+}
+
+/* Progress bar from razzak on stackoverflow 
+ * https://stackoverflow.com/questions/14539867/how-to-display-a-progress-indicator-in-pure-c-c-cout-printf/14539953
+ */
+#define PBSTR "======================================================"
+#define PBWIDTH 60
+void printProgress (double percentage)
+{
+    int val = (int) (percentage * 100);
+    int lpad = (int) (percentage * PBWIDTH);
+    int rpad = PBWIDTH - lpad;
+    printf ("\r%3d%% [%.*s%*s]", val, lpad, PBSTR, rpad, "");
+    fflush (stdout);
+}
+
+void putPixel(int x, int y, const vec3& color, int samples, float m2, const vec3& albedo, const vec3& normal, float depth)
+{
+    // Make sure the pixel is within the bounds of the canvas
+    if ((x >= 0 && x < CANVAS.width) && (y >= 0 && y < CANVAS.height))
+    {
+        CANVAS.at(x, y) = color;
+        CANVAS.samples_at(x, y) = samples;
+        CANVAS.m2_at(x, y) = m2;
+        CANVAS.albedo_at(x, y) = albedo;
+        CANVAS.normal_at(x, y) = normal;
+        CANVAS.depth_at(x, y) = depth;
+    }
+}
+
+// Adds what the camera ray r saw first to the denoiser features of its pixel. The sky
+// counts as a white surface facing the camera at depth 0
+inline void addFeatures(const ray& r, bool hit, const hit_record& rec, vec3& albedo, vec3& normal, float& depth)
+{
+    if (!hit)
+    {
+        albedo += vec3(1.0f, 1.0f, 1.0f);
+        normal -= unit_vector(r.direction());
+        return;
+    }
+    albedo += material_reflectance(rec.mat_ptr, rec);
+    normal += unit_vector(rec.normal);
+    depth += rec.t*r.direction().length();
+}
+
+// Adaptive sampling checks for convergence after every batch of this many samples
+const int ADAPTIVE_BATCH = 8;
+
+/* A pixel is converged once the standard error of its mean luminance drops
+   below the threshold relative to the mean. Dark pixels are held to an absolute
+   floor instead, otherwise near black noise would never count as converged. */
+inline bool converged(double mean, double m2, int n, float threshold)
+{
+    double variance = m2 / (n - 1);
+    double std_error = sqrt(variance / n);
+    return std_error <= threshold * std::max(mean, 0.01);
+}
+
+// Trace from the camera to the image plane based on the start and end positions
+template <lighting_mode MODE>
+void trace(int minX, int maxX, int minY, int maxY, const scene& sc, camera& cam)
+{
+    const hitable *world = sc.world;
+    const int width = SETTINGS.width;
+    const int height = SETTINGS.height;
+    const int samples = SETTINGS.samples;
+    const bool adaptive = SETTINGS.adaptive();
+    const int min_samples = adaptive ? std::max(2, std::min(SETTINGS.min_samples, samples)) : samples;
+    const int packet = SETTINGS.packet;
+    // First hit features and pixel variances are only kept when the denoiser will use them
+    const bool features = SETTINGS.denoise > 0;
+    ray rays[MAX_PACKET];
+    ray_packet rp;
+    packet_hits hits;
+    for (int j = maxY - 1; j >= minY; --j)
+    {
+        for (int i = minX; i < maxX; ++i)
+        {
+            const int pixel = j*width + i;
+            // A resumed checkpoint may already hold samples for the pixel, the new ones carry on
+            // from its sample index so the result matches a render that was never interrupted
+            const int resumed = CANVAS.samples_at(i, j);
+            int n = resumed;
+            vec3 col = CANVAS.at(i, j)*float(n);
+            vec3 albedo = CANVAS.albedo_at(i, j)*float(n), normal = CANVAS.normal_at(i, j)*float(n);
+            float depth = CANVAS.depth_at(i, j)*float(n);
+            // Running mean and variance of the sample luminance (Welford)
+            double mean = luminance(CANVAS.at(i, j)), m2 = CANVAS.m2_at(i, j);
+            bool done = adaptive && n >= min_samples && converged(mean, m2, n, SETTINGS.threshold);
+            while (n < samples && !done)
+            {
+                // The samples of one pixel are the most coherent rays there are, so they form the packets
+                int batch = packet > 0 ? std::min(packet, samples - n) : 1;
+                for (int k = 0; k < batch; ++k)
+                {
+                    begin_sample(pixel, n + k);
+                    local_stats().primary_rays++;
+                    float u = float(i + random_float()) / float(width);
+                    float v = float(j + random_float()) / float(height);
+                    rays[k] = cam.get_ray(u, v);
+                }
+                if (packet > 0)
+                {
+                    rp.size = batch;
+                    for (int k = 0; k < batch; ++k)
+                        rp.set(k, rays[k]);
+                    pad_packet(rp);
+                    hits.reset(batch, FLT_MAX);
+                    world->hit_packet(rp, 0.001f, hits);
+                }
+
+                // Secondary bounces are incoherent and go back to single rays
+                for (int k = 0; k < batch && !done; ++k)
+                {
+                    begin_sample(pixel, n);
+                    begin_bounce(0);
+                    vec3 sample;
+                    if (packet > 0)
+                    {
+                        sample = radiance<MODE>(rays[k], hits.hit[k], hits.rec[k], sc);
+                        if (features)
+                            addFeatures(rays[k], hits.hit[k], hits.rec[k], albedo, normal, depth);
+                    }
+                    else
+                    {
+                        hit_record rec;
+                        bool hit = world->hit(rays[k], 0.001f, FLT_MAX, rec);
+                        sample = radiance<MODE>(rays[k], hit, rec, sc);
+                        if (features)
+                            addFeatures(rays[k], hit, rec, albedo, normal, depth);
+                    }
+                    col += sample;
+                    n++;
+
+                    if (adaptive || features)
+                    {
+                        double l = luminance(sample);
+                        double delta = l - mean;
+                        mean += delta / n;
+                        m2 += delta * (l - mean);
+                        if (adaptive && n >= min_samples && n % ADAPTIVE_BATCH == 0 && converged(mean, m2, n, SETTINGS.threshold))
+                            done = true;
+                    }
+                }
+            }
+            if (n == resumed)
+                continue;
+            col /= float(n);
+            // Gamma correction and quantization are left to the image writer
+            putPixel(i, j, col, n, float(m2), albedo/float(n), normal/float(n), depth/float(n));
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef RENDER_SETTINGS_H
+#define RENDER_SETTINGS_H
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Lighting features compiled into the integrator
+enum lighting_mode
+  {
+    LIGHT_DIRECT,   // point light diffuse term only
+    LIGHT_SHADOWS,  // direct lighting with (soft) shadows and specular highlights
+    LIGHT_GLOBAL    // global illumination
+  };
+
+// Everything that used to be a compile time switch, filled in from the command line
+struct render_settings
+{
+  render_settings()
+    : width(640), height(480), samples(250), min_samples(16), threshold(0.0f), depth(4), roulette(3), shadow_depth(1),
+      mode(LIGHT_DIRECT), threads(0), tile_size(16), packet(0),
+      scene("beer_test"), output("output_render.ppm"), stats("render_stats.json"), heatmap(""), checkpoint(""),
+      checkpoint_interval(60.0f), seed(0), workers(0), listen(0), connect(""), worker_fd(-1), denoise(0), wavefront(0) {}
+
+  int width, height;
+  int samples;       // samples per pixel for anti aliasing, the maximum when sampling adaptively
+  int min_samples;   // adaptive sampling never stops a pixel before this many samples
+  float threshold;   // relative standard error at which a pixel is converged, 0 turns adaptive sampling off
+  int depth;         // maximum number of bounces
+  int roulette;      // bounces before russian roulette may end a path, 0 turns it off
+  int shadow_depth;  // shadow rays per hit, 1 for hard shadows. Around >= 20 gives clean soft shadows
+  lighting_mode mode;
+  int threads;       // 0 uses every hardware thread
+  int tile_size;
+  int packet;        // camera rays traced together as a SIMD packet: 4, 8 or 16, 0 for single rays
+  std::string scene;
+  std::string output;  // format is picked from the extension: .ppm (binary P6), .pfm or .png
+  std::string stats;
+  std::string heatmap; // optional image of the number of samples taken per pixel
+  std::string checkpoint;     // resumed from if it exists, and saved to while rendering
+  float checkpoint_interval;  // seconds between checkpoints
+  int seed;            // re-rolls every random number of the render and of random scenes
+  int workers;         // worker processes to fork, see distributed.h
+  int listen;          // port on which workers on other machines may join, 0 for none
+  std::string connect; // HOST:PORT of the coordinator to render tiles for
+  int worker_fd;       // socket to the coordinator of a forked worker
+  int denoise;         // a-trous filter passes run over the finished frame, 0 for none. Also makes trace() keep
+                       // the first hit features and pixel variances the filter needs
+  int wavefront;       // paths traced together by the wavefront integrator, 0 traces one path at a time
+
+  bool adaptive() const { return threshold > 0.0f; }
+  bool coordinator() const { return workers > 0 || listen > 0; }
+  bool worker() const { return worker_fd >= 0 || !connect.empty(); }
+};
+
+void print_usage(const char *program)
+{
+  std::cout << "Usage: " << program << " [options] [SCENE]\n"
+	    << "  --scene NAME          scene to render: a built in scene, a .scene file or a .obj\n"
+	    << "                        model (default beer_test)\n"
+	    << "  --width N             image width (default 640)\n"
+	    << "  --height N            image height (default 480)\n"
+	    << "  --samples N           samples per pixel, the maximum when adaptive (default 250)\n"
+	    << "  --threshold T         relative error at which a pixel stops sampling, 0 disables\n"
+	    << "                        adaptive sampling (default 0)\n"
+	    << "  --min-samples N       samples every pixel takes before it may stop (default 16)\n"
+	    << "  --heatmap FILE        write the per pixel sample counts as an image\n"
+	    << "  --depth N             maximum bounces (default 4)\n"
+	    << "  --roulette N          bounces before russian roulette may end a path, 0 disables\n"
+	    << "                        (default 3)\n"
+	    << "  --shadow-depth N      shadow rays per hit, 1 for hard shadows (default 1)\n"
+	    << "  --mode MODE           direct, shadows or global (default direct)\n"
+	    << "  --threads N           render threads, 0 for all hardware threads (default 0)\n"
+	    << "  --tile-size N         edge length of render tiles (default 16)\n"
+	    << "  --packet N            trace camera rays in SIMD packets of 4, 8 or 16 (default 0, off)\n"
+	    << "  --wavefront N         trace N paths at a time, one bounce per pass with the rays\n"
+	    << "                        sorted between passes, for big scenes; same image as\n"
+	    << "                        without, --packet is then ignored (default 0, off)\n"
+	    << "  --denoise N           filter the finished frame with N edge avoiding passes, about\n"
+	    << "                        5 cleans up 16 to 32 samples per pixel, up to 10\n"
+	    << "                        (default 0, off)\n"
+	    << "  --output FILE         .ppm, .pfm or .png (default output_render.ppm)\n"
+	    << "  --stats FILE          json render statistics (default render_stats.json)\n"
+	    << "  --checkpoint FILE     save progress to FILE while rendering, and resume from it\n"
+	    << "                        if it exists; --samples is then the total to reach\n"
+	    << "  --checkpoint-interval S\n"
+	    << "                        seconds between checkpoints (default 60)\n"
+	    << "  --seed N              seed for the random numbers of the render and scene (default 0)\n"
+	    << "  --workers N           render the tiles in N worker processes, --threads is then\n"
+	    << "                        the threads of each worker\n"
+	    << "  --listen PORT         also accept workers from other machines on PORT\n"
+	    << "  --connect HOST:PORT   run as a worker for the coordinator at HOST:PORT, with the\n"
+	    << "                        same scene and quality options as the coordinator\n";
+}
+
+bool parse_mode(const std::string& name, lighting_mode& mode)
+{
+  if (name == "direct")
+    mode = LIGHT_DIRECT;
+  else if (name == "shadows")
+    mode = LIGHT_SHADOWS;
+  else if (name == "global")
+    mode = LIGHT_GLOBAL;
+  else
+    return false;
+  return true;
+}
+
+const char *mode_name(lighting_mode mode)
+{
+  switch (mode)
+    {
+    case LIGHT_SHADOWS: return "shadows";
+    case LIGHT_GLOBAL: return "global";
+    default: return "direct";
+    }
+}
+
+// Everything besides the scene and image size that decides what samples a pixel gets
+// and what they add up to, so samples taken under different ones are never averaged.
+// Features are only recorded for the denoiser, so a frame without them cannot be denoised
+std::string sample_fingerprint(const render_settings& s)
+{
+  std::ostringstream out;
+  out << mode_name(s.mode) << " min " << s.min_samples << " threshold " << s.threshold << " depth " << s.depth
+      << " roulette " << s.roulette << " shadow " << s.shadow_depth << " seed " << s.seed
+      << " features " << (s.denoise > 0);
+  return out.str();
+}
+
+// Returns false and prints the usage on a malformed command line
+bool parse_args(int argc, char **argv, render_settings& s)
+{
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--help" || arg == "-h")
+	{
+	  print_usage(argv[0]);
+	  return false;
+	}
+      // A lone argument is the scene, so a scene file can be rendered with just its path
+      if (arg.compare(0, 2, "--") != 0)
+	{
+	  s.scene = arg;
+	  continue;
+	}
+      if (i + 1 >= argc)
+	{
+	  std::cerr << "Missing value for " << arg << std::endl;
+	  print_usage(argv[0]);
+	  return false;
+	}
+      std::string value = argv[++i];
+      int n = atoi(value.c_str());
+
+      if (arg == "--scene") s.scene = value;
+      else if (arg == "--width") s.width = n;
+      else if (arg == "--height") s.height = n;
+      else if (arg == "--samples") s.samples = n;
+      else if (arg == "--min-samples") s.min_samples = n;
+      else if (arg == "--threshold") s.threshold = (float)atof(value.c_str());
+      else if (arg == "--heatmap") s.heatmap = value;
+      else if (arg == "--depth") s.depth = n;
+      else if (arg == "--roulette") s.roulette = n;
+      else if (arg == "--shadow-depth") s.shadow_depth = n;
+      else if (arg == "--threads") s.threads = n;
+      else if (arg == "--tile-size") s.tile_size = n;
+      else if (arg == "--denoise") s.denoise = n;
+      else if (arg == "--packet") s.packet = n;
+      else if (arg == "--wavefront") s.wavefront = n;
+      else if (arg == "--output") s.output = value;
+      else if (arg == "--stats") s.stats = value;
+      else if (arg == "--checkpoint") s.checkpoint = value;
+      else if (arg == "--checkpoint-interval") s.checkpoint_interval = (float)atof(value.c_str());
+      else if (arg == "--seed") s.seed = n;
+      else if (arg == "--workers") s.workers = n;
+      else if (arg == "--listen") s.listen = n;
+      else if (arg == "--connect") s.connect = value;
+      else if (arg == "--worker-fd") s.worker_fd = n;  // passed to the processes forked by --workers
+      else if (arg == "--mode")
+	{
+	  if (!parse_mode(value, s.mode))
+	    {
+	      std::cerr << "Unknown mode " << value << std::endl;
+	      return false;
+	    }
+	}
+      else
+	{
+	  std::cerr << "Unknown option " << arg << std::endl;
+	  print_usage(argv[0]);
+	  return false;
+	}
+    }
+
+  if (s.width <= 0 || s.height <= 0 || s.samples <= 0 || s.min_samples <= 0 || s.depth < 0 || s.roulette < 0 || s.shadow_depth <= 0 || s.tile_size <= 0)
+    {
+      std::cerr << "Image size, samples, shadow depth and tile size must be positive, depth and roulette not negative" << std::endl;
+      return false;
+    }
+  if (s.checkpoint_interval <= 0.0f)
+    {
+      std::cerr << "Checkpoint interval must be positive" << std::endl;
+      return false;
+    }
+  if (s.workers < 0 || s.listen < 0 || s.listen > 65535)
+    {
+      std::cerr << "Workers must not be negative and the port must be below 65536" << std::endl;
+      return false;
+    }
+  if (s.packet != 0 && s.packet != 4 && s.packet != 8 && s.packet != 16)
+    {
+      std::cerr << "Packet size must be 4, 8 or 16" << std::endl;
+      return false;
+    }
+  // Taps of pass N are 2^(N-1) pixels apart, past 10 passes they leave any image
+  if (s.denoise < 0 || s.denoise > 10)
+    {
+      std::cerr << "Denoise passes must be between 0 and 10" << std::endl;
+      return false;
+    }
+  return true;
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+/* Render statistics. Every thread counts into its own block, padded out to
+   whole cache lines so that threads never write to the same line, and the
+   blocks are only summed once rendering is done. */
+
+enum prim_type
+  {
+    PRIM_SPHERE,
+    PRIM_MOVING_SPHERE,
+    PRIM_TRIANGLE,
+    PRIM_PLANE,
+    PRIM_QUAD,
+    NUM_PRIM_TYPES
+  };
+
+const char *PRIM_TYPE_NAMES[NUM_PRIM_TYPES] = { "sphere", "moving_sphere", "triangle", "plane", "quad" };
+
+// Paths that end deeper than this are counted in the last bucket
+const int MAX_STAT_DEPTH = 16;
+
+const int CACHE_LINE = 64;
+
+struct thread_stats
+{
+  uint64_t primary_rays;
+  uint64_t secondary_rays;
+  uint64_t shadow_rays;
+  uint64_t occluder_cache_hits;         // shadow rays blocked by the primitive that blocked the previous one
+  uint64_t box_tests;                   // bounding volume nodes visited
+  uint64_t tests[NUM_PRIM_TYPES];       // ray-primitive intersection tests
+  uint64_t hits[NUM_PRIM_TYPES];        // tests that found an intersection
+  uint64_t path_depth[MAX_STAT_DEPTH + 1];
+
+  thread_stats() { clear(); }
+  void clear() { memset(this, 0, sizeof(thread_stats)); }
+  void merge(const thread_stats& s);
+  uint64_t total_rays() const { return primary_rays + secondary_rays + shadow_rays; }
+};
+
+void thread_stats::merge(const thread_stats& s)
+{
+  primary_rays += s.primary_rays;
+  secondary_rays += s.secondary_rays;
+  shadow_rays += s.shadow_rays;
+  occluder_cache_hits += s.occluder_cache_hits;
+  box_tests += s.box_tests;
+  for (int i = 0; i < NUM_PRIM_TYPES; ++i)
+    {
+      tests[i] += s.tests[i];
+      hits[i] += s.hits[i];
+    }
+  for (int i = 0; i <= MAX_STAT_DEPTH; ++i)
+    path_depth[i] += s.path_depth[i];
+}
+
+class stats_registry
+{
+ public:
+  ~stats_registry();
+  thread_stats *register_thread();
+  thread_stats merged();
+  void reset();
+
+ private:
+  std::mutex lock;
+  std::vector<thread_stats*> blocks;
+  std::vector<char*> storage;
+};
+
+stats_registry STATS;
+thread_local thread_stats *THREAD_STATS = nullptr;
+
+stats_registry::~stats_registry()
+{
+  for (size_t i = 0; i < storage.size(); ++i)
+    delete[] storage[i];
+}
+
+thread_stats *stats_registry::register_thread()
+{
+  // Over-allocate and round up so the block starts and ends on a line boundary
+  size_t size = (sizeof(thread_stats) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  char *raw = new char[size + CACHE_LINE];
+  char *aligned = (char *)(((uintptr_t)raw + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+  thread_stats *s = new (aligned) thread_stats();
+
+  std::lock_guard<std::mutex> guard(lock);
+  storage.push_back(raw);
+  blocks.push_back(s);
+  return s;
+}
+
+// Only meaningful once the threads that counted have finished
+thread_stats stats_registry::merged()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  thread_stats total;
+  for (size_t i = 0; i < blocks.size(); ++i)
+    total.merge(*blocks[i]);
+  return total;
+}
+
+void stats_registry::reset()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (size_t i = 0; i < blocks.size(); ++i)
+    blocks[i]->clear();
+}
+
+inline thread_stats& local_stats()
+{
+  if (!THREAD_STATS)
+    THREAD_STATS = STATS.register_thread();
+  return *THREAD_STATS;
+}
+
+inline void count_path_depth(int depth)
+{
+  local_stats().path_depth[depth < MAX_STAT_DEPTH ? depth : MAX_STAT_DEPTH]++;
+}
+
+// Contents of a JSON string literal holding s, scene names can be paths with quotes or backslashes
+std::string json_escape(const std::string& s)
+{
+  std::string out;
+  for (size_t i = 0; i < s.size(); ++i)
+    {
+      unsigned char c = s[i];
+      if (c == '"' || c == '\\')
+	{
+	  out += '\\';
+	  out += c;
+	}
+      else if (c == '\n')
+	out += "\\n";
+      else if (c == '\t')
+	out += "\\t";
+      else if (c == '\r')
+	out += "\\r";
+      else if (c < 0x20)
+	{
+	  char code[8];
+	  snprintf(code, sizeof(code), "\\u%04x", c);
+	  out += code;
+	}
+      else
+	out += c;
+    }
+  return out;
+}
+
+// Machine readable summary so throughput can be tracked per scene
+void write_stats_json(const std::string& file_name, const std::string& scene_name,
+		      int width, int height, int samples, double mean_samples, int threads,
+		      double wall_seconds, const thread_stats& s)
+{
+  std::ofstream out(file_name.c_str());
+  out << "{\n";
+  out << "  \"scene\": \"" << json_escape(scene_name) << "\",\n";
+  out << "  \"width\": " << width << ",\n";
+  out << "  \"height\": " << height << ",\n";
+  out << "  \"samples\": " << samples << ",\n";
+  out << "  \"mean_samples\": " << mean_samples << ",\n";
+  out << "  \"threads\": " << threads << ",\n";
+  out << "  \"wall_seconds\": " << wall_seconds << ",\n";
+  out << "  \"rays\": { \"primary\": " << s.primary_rays
+      << ", \"secondary\": " << s.secondary_rays
+      << ", \"shadow\": " << s.shadow_rays
+      << ", \"total\": " << s.total_rays() << " },\n";
+  out << "  \"rays_per_second\": " << (wall_seconds > 0.0 ? s.total_rays() / wall_seconds : 0.0) << ",\n";
+  out << "  \"occluder_cache_hits\": " << s.occluder_cache_hits << ",\n";
+  out << "  \"box_tests\": " << s.box_tests << ",\n";
+  out << "  \"intersection_tests\": {";
+  for (int i = 0; i < NUM_PRIM_TYPES; ++i)
+    out << (i ? ", " : " ") << "\"" << PRIM_TYPE_NAMES[i] << "\": " << s.tests[i];
+  out << " },\n";
+  out << "  \"intersections\": {";
+  for (int i = 0; i < NUM_PRIM_TYPES; ++i)
+    out << (i ? ", " : " ") << "\"" << PRIM_TYPE_NAMES[i] << "\": " << s.hits[i];
+  out << " },\n";
+  out << "  \"path_depth\": [";
+  for (int i = 0; i <= MAX_STAT_DEPTH; ++i)
+    out << (i ? ", " : "") << s.path_depth[i];
+  out << "]\n";
+  out << "}\n";
+}
+
+#endif
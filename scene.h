@@ -0,0 +1,46 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+#include <vector>
+#include "hitable.h"
+#include "camera.h"
+#include "arena.h"
+
+// What a scene builder hands to the renderer
+struct scene
+{
+  scene() : world(nullptr), sky(true), objects(std::make_shared<arena>()) { set_defaults(); }
+
+  camera make_camera(float aspect_ratio) const
+  {
+    return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus_dist, 0.0f, 1.0f);
+  }
+
+  hitable *world;
+  std::vector<hitable*> lights;  // emitters sampled directly at every bounce, also part of world
+  bool sky;                      // rays that leave the scene see a sky gradient, otherwise black
+  // Owns the world and the lights with their materials and textures, freed with the last copy of the scene
+  std::shared_ptr<arena> objects;
+
+  vec3 lookfrom, lookat, vup;
+  float vfov;                    // vertical field of view in degrees
+  float aperture;
+  float focus_dist;
+  vec3 light_pos;                // point light of the direct and shadows lighting modes
+
+ private:
+  // The camera and light every scene used to share
+  void set_defaults()
+  {
+    lookfrom = vec3(50.0f, 52.0f, 295.6f);
+    lookat = unit_vector(vec3(0.0f, -0.042612f, -1.0f));
+    vup = vec3(0.0f, 1.0f, 0.0f);
+    vfov = 20.0f;
+    aperture = 0.0f;
+    focus_dist = 10.0f;
+    light_pos = vec3(-5.0f, 3.5f, 3.0f);
+  }
+};
+
+#endif
@@ -0,0 +1,565 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "sphere.h"
+#include "plane.h"
+#include "triangle.h"
+#include "moving_sphere.h"
+#include "moving_triangle.h"
+#include "quad.h"
+#include "obj_loader.h"
+#include "bvh.h"
+#include "instance.h"
+#include "material.h"
+#include "texture.h"
+#include "scene.h"
+
+/* Text scene files, so a scene can change without a rebuild. Every line is
+   one statement, a keyword followed by its arguments, and # starts a comment.
+   Textures and materials are given a name when they are defined and are
+   referred to by it afterwards. Wherever a texture is expected a colour
+   "R G B" can be given instead.
+
+     camera from X Y Z at X Y Z [up X Y Z] [vfov DEG] [aperture A] [focus D]
+     point_light X Y Z                 light of the direct and shadows modes
+     sky on|off
+
+     texture NAME constant R G B
+     texture NAME checker TEXTURE TEXTURE
+     texture NAME noise SCALE                 gray Perlin noise
+     texture NAME marble SCALE [R G B]        veins of turbulence, white by default
+     texture NAME worley SCALE f1|f2|border euclidean|manhattan|chebyshev [R G B]
+
+     material NAME lambertian TEXTURE
+     material NAME diffuse TEXTURE
+     material NAME metal R G B [FUZZ [REFLECTANCE]]
+     material NAME dielectric IOR [R G B [ABSORPTION_R G B]]
+     material NAME emissive R G B
+     material NAME color R G B
+
+     sphere X Y Z RADIUS MATERIAL
+     moving_sphere X0 Y0 Z0 X1 Y1 Z1 T0 T1 RADIUS MATERIAL
+     triangle X Y Z X Y Z X Y Z MATERIAL
+     moving_triangle X Y Z X Y Z X Y Z DX DY DZ T0 T1 MATERIAL   moved by D from T0 to T1
+     quad X Y Z UX UY UZ VX VY VZ MATERIAL   corner and two edges
+     plane X Y Z NX NY NZ MATERIAL
+     mesh FILE MATERIAL                      Wavefront OBJ, relative to the scene file
+
+     object NAME                             shapes up to the matching end make up the
+     end                                     object NAME, which is not drawn by itself
+     instance NAME [translate X Y Z] [rotate AX AY AZ DEG] [scale S | scale X Y Z] ...
+                                             a copy of object NAME moved by the
+                                             transforms, applied in the order given
+
+   The noise textures of a file share one set of Perlin tables and one Worley
+   generator, seeded by --seed. Spheres and quads with an emissive material are
+   added to the lights of the scene, unless they are part of an object. Every
+   object gets its own bvh and is shared by all its instances. The whole file
+   is read with one call and split in place, numbers are parsed straight out of
+   the buffer, and the objects are made in the arena of the scene, so the only
+   other allocations while parsing are for the names. */
+
+class scene_file_parser
+{
+ public:
+ scene_file_parser(const std::string& name) : file_name(name), line(0), ok(true), noise_tables(nullptr), cells(nullptr) {}
+  // Returns a scene with a null world, after printing the reason, if the file cannot be used
+  scene parse();
+
+ private:
+  static const int MAX_TOKENS = 32;
+
+  bool error(const std::string& message);
+  bool statement();
+  bool number(int i, float& out);
+  bool is_number(int i) const;
+  bool vector(int i, vec3& out);
+  bool texture_arg(int i, texture *&out, int& used);
+  bool material_arg(int i, material *&out);
+  bool camera_statement();
+  bool texture_statement();
+  bool material_statement();
+  bool object_statement();
+  bool end_statement();
+  bool instance_statement();
+  void add(hitable *h, material *m);
+  // Where shapes go, the object being defined or else the scene
+  std::vector<hitable*>& current() { return defining.empty() ? objects : parts; }
+  const perlin *noise();
+  const worley *cell_noise();
+  // Objects, materials and textures are all made in the arena of the scene
+  template <typename T, typename... Args>
+  T *make(Args&&... args) { return result.objects->make<T>(std::forward<Args>(args)...); }
+
+  std::string file_name;
+  int line;
+  bool ok;
+  char *tokens[MAX_TOKENS];
+  int count;
+
+  scene result;
+  std::vector<hitable*> objects;
+  std::unordered_map<std::string, texture*> textures;
+  std::unordered_map<std::string, material*> materials;
+  std::unordered_map<std::string, hitable*> shared;  // objects by name
+  std::string defining;                               // name of the object being defined, empty outside one
+  std::vector<hitable*> parts;                        // of the object being defined
+  perlin *noise_tables;
+  worley *cells;
+};
+
+bool scene_file_parser::error(const std::string& message)
+{
+  std::cerr << file_name << ":" << line << ": " << message << std::endl;
+  ok = false;
+  return false;
+}
+
+bool scene_file_parser::number(int i, float& out)
+{
+  if (i >= count)
+    return error(std::string("missing arguments for ") + tokens[0]);
+  char *end;
+  out = strtof(tokens[i], &end);
+  if (end == tokens[i] || *end != '\0')
+    return error(std::string("expected a number, got ") + tokens[i]);
+  return true;
+}
+
+// Whether token i exists and is a number, without reporting an error
+bool scene_file_parser::is_number(int i) const
+{
+  char *end;
+  return i < count && (strtof(tokens[i], &end), end != tokens[i] && *end == '\0');
+}
+
+bool scene_file_parser::vector(int i, vec3& out)
+{
+  float x, y, z;
+  if (!number(i, x) || !number(i + 1, y) || !number(i + 2, z))
+    return false;
+  out = vec3(x, y, z);
+  return true;
+}
+
+// A texture name or an inline colour, used is set to the number of tokens read
+bool scene_file_parser::texture_arg(int i, texture *&out, int& used)
+{
+  if (i >= count)
+    return error(std::string("missing texture for ") + tokens[0]);
+  std::unordered_map<std::string, texture*>::const_iterator found = textures.find(tokens[i]);
+  if (found != textures.end())
+    {
+      out = found->second;
+      used = 1;
+      return true;
+    }
+  char *end;
+  strtof(tokens[i], &end);
+  if (end == tokens[i])
+    return error(std::string("unknown texture ") + tokens[i]);
+  vec3 color;
+  if (!vector(i, color))
+    return false;
+  out = make<constant_texture>(color);
+  used = 3;
+  return true;
+}
+
+bool scene_file_parser::material_arg(int i, material *&out)
+{
+  if (i >= count)
+    return error(std::string("missing material for ") + tokens[0]);
+  std::unordered_map<std::string, material*>::const_iterator found = materials.find(tokens[i]);
+  if (found == materials.end())
+    return error(std::string("unknown material ") + tokens[i]);
+  out = found->second;
+  return true;
+}
+
+bool scene_file_parser::camera_statement()
+{
+  for (int i = 1; i < count; )
+    {
+      const char *key = tokens[i];
+      bool read;
+      if (strcmp(key, "from") == 0 || strcmp(key, "at") == 0 || strcmp(key, "up") == 0)
+	{
+	  vec3& v = key[0] == 'f' ? result.lookfrom : key[0] == 'a' ? result.lookat : result.vup;
+	  read = vector(i + 1, v);
+	  i += 4;
+	}
+      else if (strcmp(key, "vfov") == 0 || strcmp(key, "aperture") == 0 || strcmp(key, "focus") == 0)
+	{
+	  float& f = key[0] == 'v' ? result.vfov : key[0] == 'a' ? result.aperture : result.focus_dist;
+	  read = number(i + 1, f);
+	  i += 2;
+	}
+      else
+	return error(std::string("unknown camera setting ") + key);
+      if (!read)
+	return false;
+    }
+  return true;
+}
+
+// Made on first use, most scenes have no noise textures
+const perlin *scene_file_parser::noise()
+{
+  if (!noise_tables)
+    noise_tables = make<perlin>(RENDER_SEED);
+  return noise_tables;
+}
+
+const worley *scene_file_parser::cell_noise()
+{
+  if (!cells)
+    cells = make<worley>(RENDER_SEED);
+  return cells;
+}
+
+bool scene_file_parser::texture_statement()
+{
+  if (count < 3)
+    return error("expected texture NAME TYPE ...");
+  const char *type = tokens[2];
+  texture *t;
+  if (strcmp(type, "constant") == 0)
+    {
+      vec3 color;
+      if (!vector(3, color))
+	return false;
+      t = make<constant_texture>(color);
+    }
+  else if (strcmp(type, "checker") == 0)
+    {
+      texture *even, *odd;
+      int used;
+      if (!texture_arg(3, even, used) || !texture_arg(3 + used, odd, used))
+	return false;
+      t = make<checker_texture>(even, odd);
+    }
+  else if (strcmp(type, "noise") == 0 || strcmp(type, "marble") == 0)
+    {
+      float scale;
+      vec3 color(1.0f, 1.0f, 1.0f);
+      if (!number(3, scale) || (count > 4 && !vector(4, color)))
+	return false;
+      if (type[0] == 'n')
+	t = make<noise_texture>(noise(), scale);
+      else
+	t = make<marble_texture>(noise(), scale, color);
+    }
+  else if (strcmp(type, "worley") == 0)
+    {
+      float scale;
+      vec3 color(1.0f, 1.0f, 1.0f);
+      if (!number(3, scale))
+	return false;
+      if (count < 6)
+	return error("expected texture NAME worley SCALE FEATURE METRIC [R G B]");
+      const char *features[] = { "f1", "f2", "border" };
+      const char *metrics[] = { "euclidean", "manhattan", "chebyshev" };
+      int feature = std::find_if(features, features + 3, [&](const char *f) { return strcmp(f, tokens[4]) == 0; }) - features;
+      int metric = std::find_if(metrics, metrics + 3, [&](const char *m) { return strcmp(m, tokens[5]) == 0; }) - metrics;
+      if (feature == 3)
+	return error(std::string("unknown worley feature ") + tokens[4]);
+      if (metric == 3)
+	return error(std::string("unknown worley metric ") + tokens[5]);
+      if (count > 6 && !vector(6, color))
+	return false;
+      t = make<worley_texture>(cell_noise(), scale, (worley_feature)feature, (worley_metric)metric, color);
+    }
+  else
+    return error(std::string("unknown texture type ") + type);
+  textures[tokens[1]] = t;
+  return true;
+}
+
+bool scene_file_parser::material_statement()
+{
+  if (count < 3)
+    return error("expected material NAME TYPE ...");
+  const char *type = tokens[2];
+  material *m;
+  vec3 color;
+  if (strcmp(type, "lambertian") == 0 || strcmp(type, "diffuse") == 0)
+    {
+      texture *albedo;
+      int used;
+      if (!texture_arg(3, albedo, used))
+	return false;
+      if (type[0] == 'l')
+	m = make<lambertian>(albedo);
+      else
+	m = make<diffuse>(albedo);
+    }
+  else if (strcmp(type, "metal") == 0)
+    {
+      float fuzz = 0.0f, reflectance = 1.0f;
+      if (!vector(3, color) || (count > 6 && !number(6, fuzz)) || (count > 7 && !number(7, reflectance)))
+	return false;
+      m = make<metal>(color, fuzz, reflectance);
+    }
+  else if (strcmp(type, "dielectric") == 0)
+    {
+      float ior;
+      vec3 albedo(1.0f, 1.0f, 1.0f), absorption(0.0f, 0.0f, 0.0f);
+      if (!number(3, ior) || (count > 4 && !vector(4, albedo)) || (count > 7 && !vector(7, absorption)))
+	return false;
+      m = make<dielectric>(albedo, ior, absorption);
+    }
+  else if (strcmp(type, "emissive") == 0)
+    {
+      if (!vector(3, color))
+	return false;
+      m = make<emissive>(color);
+    }
+  else if (strcmp(type, "color") == 0)
+    {
+      if (!vector(3, color))
+	return false;
+      m = make<constant_color>(color);
+    }
+  else
+    return error(std::string("unknown material type ") + type);
+  materials[tokens[1]] = m;
+  return true;
+}
+
+bool scene_file_parser::object_statement()
+{
+  if (count < 2)
+    return error("expected object NAME");
+  if (!defining.empty())
+    return error("object " + defining + " is missing its end");
+  defining = tokens[1];
+  parts.clear();
+  return true;
+}
+
+bool scene_file_parser::end_statement()
+{
+  if (defining.empty())
+    return error("end without an object");
+  if (parts.empty())
+    return error("no shapes in object " + defining);
+  shared[defining] = make<bvh>(&parts[0], (int)parts.size(), 0.0f, 1.0f);
+  defining.clear();
+  return true;
+}
+
+bool scene_file_parser::instance_statement()
+{
+  if (count < 2)
+    return error("expected instance NAME ...");
+  std::unordered_map<std::string, hitable*>::const_iterator found = shared.find(tokens[1]);
+  if (found == shared.end())
+    return error(std::string("unknown object ") + tokens[1]);
+
+  // Each transform is applied after the ones before it
+  transform world;
+  for (int i = 2; i < count; )
+    {
+      const char *key = tokens[i];
+      vec3 v;
+      float f;
+      if (strcmp(key, "translate") == 0)
+	{
+	  if (!vector(i + 1, v))
+	    return false;
+	  world = transform::translate(v) * world;
+	  i += 4;
+	}
+      else if (strcmp(key, "rotate") == 0)
+	{
+	  if (!vector(i + 1, v) || !number(i + 4, f))
+	    return false;
+	  world = transform::rotate(v, f) * world;
+	  i += 5;
+	}
+      else if (strcmp(key, "scale") == 0)
+	{
+	  // One factor for every axis unless three numbers follow
+	  bool three = is_number(i + 2) && is_number(i + 3);
+	  if (three ? !vector(i + 1, v) : !number(i + 1, f))
+	    return false;
+	  world = transform::scale(three ? v : vec3(f, f, f)) * world;
+	  i += three ? 4 : 2;
+	}
+      else
+	return error(std::string("unknown transform ") + key);
+    }
+  current().push_back(make<instance>(found->second, world));
+  return true;
+}
+
+void scene_file_parser::add(hitable *h, material *m)
+{
+  current().push_back(h);
+  // Only spheres and quads can be sampled, other emitters glow when hit
+  bool sampled = h->kind == HITABLE_SPHERE || h->kind == HITABLE_QUAD;
+  if (m->kind == MATERIAL_EMISSIVE && sampled && defining.empty())
+    result.lights.push_back(h);
+}
+
+bool scene_file_parser::statement()
+{
+  const char *keyword = tokens[0];
+  vec3 a, b, c, d;
+  float r, t0, t1;
+  material *m;
+  if (strcmp(keyword, "camera") == 0)
+    return camera_statement();
+  if (strcmp(keyword, "point_light") == 0)
+    return vector(1, result.light_pos);
+  if (strcmp(keyword, "sky") == 0)
+    {
+      if (count < 2 || (strcmp(tokens[1], "on") != 0 && strcmp(tokens[1], "off") != 0))
+	return error("expected sky on or sky off");
+      result.sky = strcmp(tokens[1], "on") == 0;
+      return true;
+    }
+  if (strcmp(keyword, "texture") == 0)
+    return texture_statement();
+  if (strcmp(keyword, "material") == 0)
+    return material_statement();
+  if (strcmp(keyword, "object") == 0)
+    return object_statement();
+  if (strcmp(keyword, "end") == 0)
+    return end_statement();
+  if (strcmp(keyword, "instance") == 0)
+    return instance_statement();
+
+  if (strcmp(keyword, "sphere") == 0)
+    {
+      if (!vector(1, a) || !number(4, r) || !material_arg(5, m))
+	return false;
+      add(make<sphere>(a, r, m), m);
+    }
+  else if (strcmp(keyword, "moving_sphere") == 0)
+    {
+      if (!vector(1, a) || !vector(4, b) || !number(7, t0) || !number(8, t1) || !number(9, r) || !material_arg(10, m))
+	return false;
+      add(make<moving_sphere>(a, b, t0, t1, r, m), m);
+    }
+  else if (strcmp(keyword, "triangle") == 0)
+    {
+      if (!vector(1, a) || !vector(4, b) || !vector(7, c) || !material_arg(10, m))
+	return false;
+      add(make<triangle>(a, b, c, m), m);
+    }
+  else if (strcmp(keyword, "moving_triangle") == 0)
+    {
+      if (!vector(1, a) || !vector(4, b) || !vector(7, c) || !vector(10, d) || !number(13, t0) || !number(14, t1) || !material_arg(15, m))
+	return false;
+      vec3 start[3] = { a, b, c };
+      vec3 end[3] = { a + d, b + d, c + d };
+      add(make<moving_triangle>(start, end, t0, t1, m), m);
+    }
+  else if (strcmp(keyword, "quad") == 0)
+    {
+      if (!vector(1, a) || !vector(4, b) || !vector(7, c) || !material_arg(10, m))
+	return false;
+      add(make<quad>(a, b, c, m), m);
+    }
+  else if (strcmp(keyword, "plane") == 0)
+    {
+      if (!vector(1, a) || !vector(4, d) || !material_arg(7, m))
+	return false;
+      add(make<plane>(a, 0.0f, 0.0f, unit_vector(d), m), m);
+    }
+  else if (strcmp(keyword, "mesh") == 0)
+    {
+      if (count < 3)
+	return error("expected mesh FILE MATERIAL");
+      if (!material_arg(2, m))
+	return false;
+      std::string path = tokens[1];
+      size_t slash = file_name.find_last_of('/');
+      if (path[0] != '/' && slash != std::string::npos)
+	path = file_name.substr(0, slash + 1) + path;
+      mesh *model = load_obj(path, m, *result.objects);
+      if (!model)
+	return error("cannot load mesh " + path);
+      current().push_back(model);
+    }
+  else
+    return error(std::string("unknown statement ") + keyword);
+  return true;
+}
+
+scene scene_file_parser::parse()
+{
+  std::ifstream in(file_name.c_str(), std::ios::binary | std::ios::ate);
+  if (!in)
+    {
+      std::cerr << "Cannot open scene " << file_name << std::endl;
+      return scene();
+    }
+  std::vector<char> text((size_t)in.tellg() + 1, '\0');
+  in.seekg(0);
+  in.read(&text[0], text.size() - 1);
+
+  // Tokens are cut out of the buffer by writing terminators over the spaces after them
+  char *p = &text[0];
+  char *end = p + text.size() - 1;
+  while (p < end && ok)
+    {
+      ++line;
+      char *line_end = (char *)memchr(p, '\n', end - p);
+      if (!line_end)
+	line_end = end;
+      *line_end = '\0';
+      char *comment = strchr(p, '#');
+      if (comment)
+	*comment = '\0';
+
+      count = 0;
+      while (true)
+	{
+	  while (*p == ' ' || *p == '\t' || *p == '\r')
+	    ++p;
+	  if (*p == '\0')
+	    break;
+	  if (count == MAX_TOKENS)
+	    {
+	      error("line is too long");
+	      break;
+	    }
+	  tokens[count++] = p;
+	  while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r')
+	    ++p;
+	  if (*p != '\0')
+	    *p++ = '\0';
+	}
+      if (ok && count > 0)
+	statement();
+      p = line_end + 1;
+    }
+
+  if (ok && !defining.empty())
+    error("object " + defining + " is missing its end");
+  if (ok && objects.empty())
+    error("no objects in the scene");
+  if (!ok)
+    return scene();
+  result.world = make<bvh>(&objects[0], (int)objects.size(), 0.0f, 1.0f);
+  return result;
+}
+
+scene load_scene_file(const std::string& file_name)
+{
+  return scene_file_parser(file_name).parse();
+}
+
+#endif
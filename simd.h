@@ -0,0 +1,185 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/* Thin wrapper over the widest float vectors the compiler was told it may use:
+   8 lanes with AVX (build with ARCH=-mavx or -march=native), 4 lanes with the
+   SSE2 that every x86-64 cpu has, and a single lane anywhere else. Code written
+   against vfloat and vmask compiles to all three. */
+
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+
+const int SIMD_WIDTH = 8;
+
+struct vmask
+{
+  vmask() {}
+ vmask(__m256 m) : v(m) {}
+  __m256 v;
+};
+
+struct vfloat
+{
+  vfloat() {}
+ vfloat(__m256 x) : v(x) {}
+ vfloat(float x) : v(_mm256_set1_ps(x)) {}
+  static vfloat load(const float *p) { return _mm256_load_ps(p); }
+  static vfloat loadu(const float *p) { return _mm256_loadu_ps(p); }
+  void store(float *p) const { _mm256_store_ps(p, v); }
+  __m256 v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a) { return _mm256_sub_ps(_mm256_setzero_ps(), a.v); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+inline vfloat vfloor(vfloat a) { return _mm256_floor_ps(a.v); }
+// Like the scalar ffmin/ffmax these return the second argument when the first is NaN
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+
+inline vmask operator<(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vmask operator>(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vmask operator<=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vmask operator&(vmask a, vmask b) { return _mm256_and_ps(a.v, b.v); }
+inline vmask operator|(vmask a, vmask b) { return _mm256_or_ps(a.v, b.v); }
+// a and not b
+inline vmask andnot(vmask a, vmask b) { return _mm256_andnot_ps(b.v, a.v); }
+inline int movemask(vmask m) { return _mm256_movemask_ps(m.v); }
+inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+
+// Lane i gets the first three floats of the 16 byte aligned row table + 4 * index[i]
+inline void gather3(const float *table, const int *index, vfloat& x, vfloat& y, vfloat& z)
+{
+  __m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(table + 4 * index[0])), _mm_load_ps(table + 4 * index[4]), 1);
+  __m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(table + 4 * index[1])), _mm_load_ps(table + 4 * index[5]), 1);
+  __m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(table + 4 * index[2])), _mm_load_ps(table + 4 * index[6]), 1);
+  __m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(table + 4 * index[3])), _mm_load_ps(table + 4 * index[7]), 1);
+  __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpacklo_ps(r2, r3);
+  __m256 t2 = _mm256_unpackhi_ps(r0, r1), t3 = _mm256_unpackhi_ps(r2, r3);
+  x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+  y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+  z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+}
+
+#elif defined(__SSE2__)
+
+const int SIMD_WIDTH = 4;
+
+struct vmask
+{
+  vmask() {}
+ vmask(__m128 m) : v(m) {}
+  __m128 v;
+};
+
+struct vfloat
+{
+  vfloat() {}
+ vfloat(__m128 x) : v(x) {}
+ vfloat(float x) : v(_mm_set1_ps(x)) {}
+  static vfloat load(const float *p) { return _mm_load_ps(p); }
+  static vfloat loadu(const float *p) { return _mm_loadu_ps(p); }
+  void store(float *p) const { _mm_store_ps(p, v); }
+  __m128 v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a) { return _mm_sub_ps(_mm_setzero_ps(), a.v); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+
+inline vmask operator<(vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vmask operator>(vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vmask operator<=(vfloat a, vfloat b) { return _mm_cmple_ps(a.v, b.v); }
+inline vmask operator&(vmask a, vmask b) { return _mm_and_ps(a.v, b.v); }
+inline vmask operator|(vmask a, vmask b) { return _mm_or_ps(a.v, b.v); }
+inline vmask andnot(vmask a, vmask b) { return _mm_andnot_ps(b.v, a.v); }
+inline int movemask(vmask m) { return _mm_movemask_ps(m.v); }
+inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+
+// SSE2 has no rounding instructions, truncate and correct negative values instead
+inline vfloat vfloor(vfloat a)
+{
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)));
+}
+
+// Lane i gets the first three floats of the 16 byte aligned row table + 4 * index[i]
+inline void gather3(const float *table, const int *index, vfloat& x, vfloat& y, vfloat& z)
+{
+  __m128 r0 = _mm_load_ps(table + 4 * index[0]), r1 = _mm_load_ps(table + 4 * index[1]);
+  __m128 r2 = _mm_load_ps(table + 4 * index[2]), r3 = _mm_load_ps(table + 4 * index[3]);
+  __m128 t0 = _mm_unpacklo_ps(r0, r1), t1 = _mm_unpacklo_ps(r2, r3);
+  __m128 t2 = _mm_unpackhi_ps(r0, r1), t3 = _mm_unpackhi_ps(r2, r3);
+  x = _mm_movelh_ps(t0, t1);
+  y = _mm_movehl_ps(t1, t0);
+  z = _mm_movelh_ps(t2, t3);
+}
+
+#else
+
+const int SIMD_WIDTH = 1;
+
+struct vmask
+{
+  vmask() {}
+ vmask(bool m) : v(m) {}
+  bool v;
+};
+
+struct vfloat
+{
+  vfloat() {}
+ vfloat(float x) : v(x) {}
+  static vfloat load(const float *p) { return *p; }
+  static vfloat loadu(const float *p) { return *p; }
+  void store(float *p) const { *p = v; }
+  float v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return a.v + b.v; }
+inline vfloat operator-(vfloat a, vfloat b) { return a.v - b.v; }
+inline vfloat operator*(vfloat a, vfloat b) { return a.v * b.v; }
+inline vfloat operator/(vfloat a, vfloat b) { return a.v / b.v; }
+inline vfloat operator-(vfloat a) { return -a.v; }
+inline vfloat vsqrt(vfloat a) { return sqrtf(a.v); }
+inline vfloat vfloor(vfloat a) { return floorf(a.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return a.v < b.v ? a.v : b.v; }
+inline vfloat vmax(vfloat a, vfloat b) { return a.v > b.v ? a.v : b.v; }
+
+inline vmask operator<(vfloat a, vfloat b) { return a.v < b.v; }
+inline vmask operator>(vfloat a, vfloat b) { return a.v > b.v; }
+inline vmask operator<=(vfloat a, vfloat b) { return a.v <= b.v; }
+inline vmask operator&(vmask a, vmask b) { return a.v && b.v; }
+inline vmask operator|(vmask a, vmask b) { return a.v || b.v; }
+inline vmask andnot(vmask a, vmask b) { return a.v && !b.v; }
+inline int movemask(vmask m) { return m.v ? 1 : 0; }
+inline vfloat select(vmask m, vfloat a, vfloat b) { return m.v ? a : b; }
+
+inline void gather3(const float *table, const int *index, vfloat& x, vfloat& y, vfloat& z)
+{
+  const float *row = table + 4 * index[0];
+  x = row[0];
+  y = row[1];
+  z = row[2];
+}
+
+#endif
+
+inline bool any(vmask m) { return movemask(m) != 0; }
+
+#endif
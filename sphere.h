@@ -2,52 +2,175 @@
 #define SPHERE_H
 
 #include "vec3.h"
+#include "random.h"
 #include "hitable.h"
 
-class sphere : public hitable
+class sphere final : public hitable
 {
  public:
-  sphere() {}
- sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m) {};
+  sphere() : hitable(HITABLE_SPHERE) {}
+ sphere(vec3 cen, float r, material *m) : hitable(HITABLE_SPHERE), center(cen), radius(r), mat_ptr(m) {};
   virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
+  virtual float pdf_value(const vec3& o, const vec3& v) const;
+  virtual vec3 random(const vec3& o) const;
   vec3 center;
   float radius;
   material *mat_ptr;
 };
 
+/* b*b - a*c cancels catastrophically for small spheres far from the ray
+   origin, so the discriminant is taken from the distance between the centre and
+   the closest point on the ray instead (Ray Tracing Gems, chapter 7). */
 bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+  local_stats().tests[PRIM_SPHERE]++;
   vec3 oc = r.origin() - center;
   float a = dot(r.direction(), r.direction());
   float b = dot(r.direction(), oc);
-  float c = dot(oc, oc) - (radius * radius);
-
-  float discriminant = b*b - a*c;
+  vec3 l = oc - (b / a) * r.direction();
+  float discriminant = a * (radius * radius - dot(l, l));
   if (discriminant > 0)
-    {      
-      float temp = (-b - sqrt(b*b - a*c))/(a);  // closest point on sphere from that ray
-      float temp_far = (-b + sqrt(b*b - a*c))/(a); // farthest point on sphere from that ray
-      if (temp < t_max && temp > t_min)
+    {
+      float root = sqrt(discriminant);
+      float t_near = (-b - root) / a;  // closest point on sphere from that ray
+      float t_far = (-b + root) / a;   // farthest point on sphere from that ray
+      float temp;
+      if (t_near < t_max && t_near > t_min)
 	{
-	  rec.t = temp;
-	  rec.t_far = temp_far;
-	  rec.p = r.point_at_parameter(rec.t);
-	  rec.normal = (rec.p - center) / radius; // divide by radius to normalize
-	  rec.mat_ptr = mat_ptr;
-	  return true;
+	  temp = t_near;
+	  rec.t_far = t_far;
+	}
+      else if (t_far < t_max && t_far > t_min)
+	{
+	  temp = t_far;
+	  rec.t_far = t_near; // for when different perspectives result in negative values
 	}
-      temp = (-b + sqrt(b*b - a*c))/(a);
-      if (temp < t_max && temp > t_min)
+      else
+	return false;
+
+      rec.t = temp;
+      rec.p = r.point_at_parameter(rec.t);
+      rec.normal = (rec.p - center) / radius; // divide by radius to normalize
+      rec.u = rec.v = 0.0f;
+      rec.mat_ptr = mat_ptr;
+      local_stats().hits[PRIM_SPHERE]++;
+      return true;
+    }
+  return false;
+}
+
+// Same arithmetic as hit(), SIMD_WIDTH rays at a time
+void sphere::hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const
+{
+  local_stats().tests[PRIM_SPHERE] += rp.size;
+  const vfloat cx(center.x()), cy(center.y()), cz(center.z());
+  const vfloat rr(radius * radius), zero(0.0f), tmin(t_min);
+  for (int k = 0; k < rp.size; k += SIMD_WIDTH)
+    {
+      vfloat dx = vfloat::load(rp.dx + k), dy = vfloat::load(rp.dy + k), dz = vfloat::load(rp.dz + k);
+      vfloat ocx = vfloat::load(rp.ox + k) - cx;
+      vfloat ocy = vfloat::load(rp.oy + k) - cy;
+      vfloat ocz = vfloat::load(rp.oz + k) - cz;
+      vfloat a = dx*dx + dy*dy + dz*dz;
+      vfloat b = dx*ocx + dy*ocy + dz*ocz;
+      vfloat s = b / a;
+      vfloat lx = ocx - s*dx, ly = ocy - s*dy, lz = ocz - s*dz;
+      vfloat discriminant = a * (rr - (lx*lx + ly*ly + lz*lz));
+      vmask valid = discriminant > zero;
+      if (!any(valid))
+	continue;
+
+      vfloat root = vsqrt(discriminant);
+      vfloat t_near = (-b - root) / a;
+      vfloat t_far = (-b + root) / a;
+      vfloat tmax = vfloat::load(hits.t + k);
+      vmask near_hit = valid & (t_near < tmax) & (t_near > tmin);
+      vmask far_hit = andnot(valid & (t_far < tmax) & (t_far > tmin), near_hit);
+      int mask = movemask(near_hit | far_hit);
+      if (!mask)
+	continue;
+
+      alignas(32) float tn[SIMD_WIDTH], tf[SIMD_WIDTH];
+      t_near.store(tn);
+      t_far.store(tf);
+      int near_mask = movemask(near_hit);
+      for (int l = 0; l < SIMD_WIDTH; ++l)
 	{
-	  rec.t = temp;
-	  rec.t_far = (-b - sqrt(b*b - a*c))/(a); // for when different perspectives result in negative values
-	  rec.p = r.point_at_parameter(rec.t);
+	  if (!(mask & (1 << l)))
+	    continue;
+	  int i = k + l;
+	  bool is_near = near_mask & (1 << l);
+	  hit_record& rec = hits.rec[i];
+	  rec.t = is_near ? tn[l] : tf[l];
+	  rec.t_far = is_near ? tf[l] : tn[l];
+	  rec.p = rp.get(i).point_at_parameter(rec.t);
 	  rec.normal = (rec.p - center) / radius;
+	  rec.u = rec.v = 0.0f;
 	  rec.mat_ptr = mat_ptr;
-	  return true;
+	  hits.t[i] = rec.t;
+	  hits.hit[i] = true;
+	  local_stats().hits[PRIM_SPHERE]++;
 	}
     }
+}
+
+bool sphere::occluded(const ray& r, float t_min, float t_max) const
+{
+  local_stats().tests[PRIM_SPHERE]++;
+  vec3 oc = r.origin() - center;
+  float a = dot(r.direction(), r.direction());
+  float b = dot(r.direction(), oc);
+  vec3 l = oc - (b / a) * r.direction();
+  float discriminant = a * (radius * radius - dot(l, l));
+  if (discriminant <= 0)
+    return false;
+  float root = sqrt(discriminant);
+  float t_near = (-b - root) / a;
+  float t_far = (-b + root) / a;
+  if ((t_near < t_max && t_near > t_min) || (t_far < t_max && t_far > t_min))
+    {
+      local_stats().hits[PRIM_SPHERE]++;
+      return true;
+    }
   return false;
 }
 
+/* As a light the sphere is sampled uniformly over the cone of directions it
+   covers seen from o, so the density is one over that cone's solid angle.
+   Points inside the sphere cannot sample it. */
+float sphere::pdf_value(const vec3& o, const vec3& v) const
+{
+  float dist2 = (center - o).squared_length();
+  if (dist2 <= radius * radius || !occluded(ray(o, v, 0.0f), 0.001f, FLT_MAX))
+    return 0.0f;
+  float cos_max = sqrt(1.0f - radius * radius / dist2);
+  return 1.0f / (2.0f * float(M_PI) * (1.0f - cos_max));
+}
+
+vec3 sphere::random(const vec3& o) const
+{
+  vec3 axis = center - o;
+  float dist2 = axis.squared_length();
+  if (dist2 <= radius * radius)
+    return axis;
+  float cos_max = sqrt(1.0f - radius * radius / dist2);
+  float r1 = random_float(), r2 = random_float();
+  float z = 1.0f + r2 * (cos_max - 1.0f);
+  float s = sqrt(std::max(0.0f, 1.0f - z * z));
+  float phi = 2.0f * float(M_PI) * r1;
+  vec3 w = unit_vector(axis), t, b;
+  orthonormal_basis(w, t, b);
+  return (cos(phi) * s) * t + (sin(phi) * s) * b + z * w;
+}
+
+bool sphere::bounding_box(float t0, float t1, aabb& box) const
+{
+  vec3 rad(radius, radius, radius);
+  box = aabb(center - rad, center + rad);
+  return true;
+}
+
 #endif
@@ -0,0 +1,214 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "sphere.h"
+#include "simd.h"
+#include "arena.h"
+
+// Spheres per set, a whole number of vectors for every SIMD width
+const int SPHERE_SET_SIZE = 16;
+
+/* Up to SPHERE_SET_SIZE spheres stored as structure of arrays, so one ray is
+   tested against SIMD_WIDTH of them per instruction and only the closest hit is
+   turned into a hit_record. Materials are shared through a small table and
+   referenced by index. Used as the leaf primitive for scenes with many small
+   spheres (see make_sphere_sets). */
+class sphere_set final : public hitable
+{
+ public:
+  sphere_set() : hitable(HITABLE_SPHERE_SET), count(0) {}
+  sphere_set(sphere **spheres, int n);
+  virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual bool occluded(const ray& r, float t_min, float t_max) const;
+
+  // Sets may be allocated with plain new, which does not honour alignas before
+  // C++17, so the arrays are read with unaligned loads
+  int count;
+  float cx[SPHERE_SET_SIZE];
+  float cy[SPHERE_SET_SIZE];
+  float cz[SPHERE_SET_SIZE];
+  float radius[SPHERE_SET_SIZE];
+  unsigned char mat_index[SPHERE_SET_SIZE];
+  std::vector<material*> materials;
+};
+
+sphere_set::sphere_set(sphere **spheres, int n) : hitable(HITABLE_SPHERE_SET), count(n)
+{
+  for (int i = 0; i < SPHERE_SET_SIZE; ++i)
+    {
+      // Unused slots hold spheres of radius 0, which no ray can hit
+      const bool used = i < n;
+      cx[i] = used ? spheres[i]->center.x() : 0.0f;
+      cy[i] = used ? spheres[i]->center.y() : 0.0f;
+      cz[i] = used ? spheres[i]->center.z() : 0.0f;
+      radius[i] = used ? spheres[i]->radius : 0.0f;
+      mat_index[i] = 0;
+      if (!used)
+	continue;
+
+      std::vector<material*>::iterator it = std::find(materials.begin(), materials.end(), spheres[i]->mat_ptr);
+      mat_index[i] = (unsigned char)(it - materials.begin());
+      if (it == materials.end())
+	materials.push_back(spheres[i]->mat_ptr);
+    }
+}
+
+// Same arithmetic as sphere::hit(), SIMD_WIDTH spheres at a time
+bool sphere_set::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+  local_stats().tests[PRIM_SPHERE] += count;
+  const vfloat ox(r.origin().x()), oy(r.origin().y()), oz(r.origin().z());
+  const vfloat dx(r.direction().x()), dy(r.direction().y()), dz(r.direction().z());
+  const vfloat a = dot(r.direction(), r.direction());
+  const vfloat tmin(t_min);
+
+  // Every lane keeps the closest hit among the spheres it has seen
+  alignas(32) float lane_t[SPHERE_SET_SIZE], lane_far[SPHERE_SET_SIZE];
+  vfloat closest(t_max);
+  for (int k = 0; k < count; k += SIMD_WIDTH)
+    {
+      vfloat ocx = ox - vfloat::loadu(cx + k);
+      vfloat ocy = oy - vfloat::loadu(cy + k);
+      vfloat ocz = oz - vfloat::loadu(cz + k);
+      vfloat rad = vfloat::loadu(radius + k);
+      vfloat b = dx*ocx + dy*ocy + dz*ocz;
+      vfloat s = b / a;
+      vfloat lx = ocx - s*dx, ly = ocy - s*dy, lz = ocz - s*dz;
+      vfloat discriminant = a * (rad*rad - (lx*lx + ly*ly + lz*lz));
+      vmask valid = discriminant > vfloat(0.0f);
+
+      vfloat root = vsqrt(discriminant);
+      vfloat t_near = (-b - root) / a;
+      vfloat t_far = (-b + root) / a;
+      vmask near_hit = valid & (t_near < closest) & (t_near > tmin);
+      vmask far_hit = andnot(valid & (t_far < closest) & (t_far > tmin), near_hit);
+      vfloat t = select(near_hit, t_near, select(far_hit, t_far, vfloat(FLT_MAX)));
+      select(near_hit, t_far, t_near).store(lane_far + k);
+      t.store(lane_t + k);
+      closest = vmin(closest, t);
+    }
+
+  int best = -1;
+  float best_t = t_max;
+  for (int i = 0; i < count; ++i)
+    {
+      if (lane_t[i] < best_t)
+	{
+	  best_t = lane_t[i];
+	  best = i;
+	}
+    }
+  if (best < 0)
+    return false;
+
+  vec3 center(cx[best], cy[best], cz[best]);
+  rec.t = best_t;
+  rec.t_far = lane_far[best];
+  rec.p = r.point_at_parameter(rec.t);
+  rec.normal = (rec.p - center) / radius[best];
+  rec.u = rec.v = 0.0f;
+  rec.mat_ptr = materials[mat_index[best]];
+  local_stats().hits[PRIM_SPHERE]++;
+  return true;
+}
+
+bool sphere_set::occluded(const ray& r, float t_min, float t_max) const
+{
+  const vfloat ox(r.origin().x()), oy(r.origin().y()), oz(r.origin().z());
+  const vfloat dx(r.direction().x()), dy(r.direction().y()), dz(r.direction().z());
+  const vfloat a = dot(r.direction(), r.direction());
+  const vfloat tmin(t_min), tmax(t_max);
+  for (int k = 0; k < count; k += SIMD_WIDTH)
+    {
+      local_stats().tests[PRIM_SPHERE] += std::min(SIMD_WIDTH, count - k);
+      vfloat ocx = ox - vfloat::loadu(cx + k);
+      vfloat ocy = oy - vfloat::loadu(cy + k);
+      vfloat ocz = oz - vfloat::loadu(cz + k);
+      vfloat rad = vfloat::loadu(radius + k);
+      vfloat b = dx*ocx + dy*ocy + dz*ocz;
+      vfloat s = b / a;
+      vfloat lx = ocx - s*dx, ly = ocy - s*dy, lz = ocz - s*dz;
+      vfloat discriminant = a * (rad*rad - (lx*lx + ly*ly + lz*lz));
+      vmask valid = discriminant > vfloat(0.0f);
+
+      vfloat root = vsqrt(discriminant);
+      vfloat t_near = (-b - root) / a;
+      vfloat t_far = (-b + root) / a;
+      vmask blocked = valid & (((t_near < tmax) & (t_near > tmin)) | ((t_far < tmax) & (t_far > tmin)));
+      if (any(blocked))
+	{
+	  local_stats().hits[PRIM_SPHERE]++;
+	  return true;
+	}
+    }
+  return false;
+}
+
+bool sphere_set::bounding_box(float t0, float t1, aabb& box) const
+{
+  box = aabb();
+  for (int i = 0; i < count; ++i)
+    {
+      vec3 rad(radius[i], radius[i], radius[i]);
+      vec3 center(cx[i], cy[i], cz[i]);
+      box.expand(aabb(center - rad, center + rad));
+    }
+  return count > 0;
+}
+
+// Spread the low 10 bits of x so there are two zero bits between each of them
+inline uint32_t morton_spread(uint32_t x)
+{
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+/* Pack spheres into sphere_sets of nearby spheres: sort them along a Morton
+   curve through their centres and cut the sorted list into runs of
+   SPHERE_SET_SIZE. The sets are made in the arena a, in curve order,
+   appended to out, and the number made is returned. */
+int make_sphere_sets(sphere **spheres, int n, std::vector<hitable*>& out, arena& a)
+{
+  if (n <= 0)
+    return 0;
+  aabb bounds;
+  for (int i = 0; i < n; ++i)
+    bounds.expand(spheres[i]->center);
+  vec3 extent = bounds.max() - bounds.min();
+
+  std::vector<std::pair<uint32_t, sphere*> > keyed(n);
+  for (int i = 0; i < n; ++i)
+    {
+      uint32_t code = 0;
+      for (int a = 0; a < 3; ++a)
+	{
+	  float f = extent[a] > 0.0f ? (spheres[i]->center[a] - bounds.min()[a]) / extent[a] : 0.0f;
+	  code |= morton_spread(uint32_t(f * 1023.0f)) << a;
+	}
+      keyed[i] = std::make_pair(code, spheres[i]);
+    }
+  std::stable_sort(keyed.begin(), keyed.end(),
+		   [](const std::pair<uint32_t, sphere*>& x, const std::pair<uint32_t, sphere*>& y) { return x.first < y.first; });
+
+  int sets = 0;
+  sphere *group[SPHERE_SET_SIZE];
+  for (int start = 0; start < n; start += SPHERE_SET_SIZE)
+    {
+      int m = std::min(SPHERE_SET_SIZE, n - start);
+      for (int i = 0; i < m; ++i)
+	group[i] = keyed[start + i].second;
+      out.push_back(a.make<sphere_set>(group, m));
+      sets++;
+    }
+  return sets;
+}
+
+#endif
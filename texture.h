@@ -1,17 +1,37 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include "perlin.h"
+#include "worley.h"
+
+// Built in textures, looked up by texture_value() without a virtual call
+enum texture_kind
+  {
+    TEXTURE_OTHER,
+    TEXTURE_CONSTANT,
+    TEXTURE_CHECKER,
+    TEXTURE_NOISE,
+    TEXTURE_MARBLE,
+    TEXTURE_WORLEY
+  };
+
 class texture
 {
  public:
+  texture() : kind(TEXTURE_OTHER) {}
+  explicit texture(texture_kind k) : kind(k) {}
   virtual vec3 value(float u, float v, const vec3& p) const = 0;
+
+  texture_kind kind;
 };
 
-class constant_texture : public texture
+inline vec3 texture_value(const texture *t, float u, float v, const vec3& p);
+
+class constant_texture final : public texture
 {
  public:
-  constant_texture() {}
- constant_texture(vec3 c) : color(c) {}
+  constant_texture() : texture(TEXTURE_CONSTANT) {}
+ constant_texture(vec3 c) : texture(TEXTURE_CONSTANT), color(c) {}
   virtual vec3 value(float u, float v, const vec3& p) const
   {
     return color;
@@ -20,25 +40,88 @@ class constant_texture : public texture
   vec3 color;  
 };
 
-class checker_texture : public texture
+class checker_texture final : public texture
 {
  public:
-  checker_texture() {}
- checker_texture(texture *t0, texture *t1) : even(t0), odd(t1) {}
+  checker_texture() : texture(TEXTURE_CHECKER) {}
+ checker_texture(texture *t0, texture *t1) : texture(TEXTURE_CHECKER), even(t0), odd(t1) {}
 
   virtual vec3 value(float u, float v, const vec3& p) const
   {
     float sines = sin(5*p.x()) * sin(5*p.y()) * sin(5*p.z());
     if (sines < 0)
-      return odd->value(u, v, p);
+      return texture_value(odd, u, v, p);
     else
-      return even->value(u, v, p);
+      return texture_value(even, u, v, p);
   }
   
   texture *even;
   texture *odd;
 };
 
+// Gray gradient noise, scale sets how many features fit in a unit of the scene
+class noise_texture final : public texture
+{
+ public:
+ noise_texture(const perlin *n, float s) : texture(TEXTURE_NOISE), noise(n), scale(s) {}
+
+  virtual vec3 value(float u, float v, const vec3& p) const
+  {
+    float n = 0.5f * (1.0f + noise->noise(scale * p));
+    return vec3(n, n, n);
+  }
+
+  const perlin *noise;
+  float scale;
+};
+
+// Bands along z whose phase is pushed around by turbulence, which makes them look like veins
+class marble_texture final : public texture
+{
+ public:
+ marble_texture(const perlin *n, float s, const vec3& c, int d = 7) : texture(TEXTURE_MARBLE), noise(n), scale(s), color(c), depth(d) {}
+
+  virtual vec3 value(float u, float v, const vec3& p) const
+  {
+    return 0.5f * (1.0f + sinf(scale * p.z() + 10.0f * noise->turb(p, depth))) * color;
+  }
+
+  const perlin *noise;
+  float scale;
+  vec3 color;
+  int depth;  // turbulence octaves
+};
+
+// Which Worley distance a worley_texture shows
+enum worley_feature
+  {
+    WORLEY_F1,      // spots, darkest at the feature points
+    WORLEY_F2,
+    WORLEY_BORDER   // F2 - F1, dark lines where two cells meet
+  };
+
+// Cellular noise, color scaled by the chosen distance. scale sets how many cells fit in a unit of the scene
+class worley_texture final : public texture
+{
+ public:
+ worley_texture(const worley *n, float s, worley_feature f, worley_metric m, const vec3& c)
+   : texture(TEXTURE_WORLEY), noise(n), scale(s), feature(f), metric(m), color(c) {}
+
+  virtual vec3 value(float u, float v, const vec3& p) const
+  {
+    float f1, f2;
+    noise->distances(scale * p, metric, f1, f2);
+    float d = feature == WORLEY_F1 ? f1 : feature == WORLEY_F2 ? f2 : f2 - f1;
+    return std::min(d, 1.0f) * color;
+  }
+
+  const worley *noise;
+  float scale;
+  worley_feature feature;
+  worley_metric metric;
+  vec3 color;
+};
+
 class texture_pad : public texture
 {
  public:
@@ -55,4 +138,18 @@ class texture_pad : public texture
   texture *tex1;
 };
 
+// Materials look their textures up through here, so nested built in textures are called directly too
+inline vec3 texture_value(const texture *t, float u, float v, const vec3& p)
+{
+  switch (t->kind)
+    {
+    case TEXTURE_CONSTANT: return static_cast<const constant_texture *>(t)->color;
+    case TEXTURE_CHECKER: return static_cast<const checker_texture *>(t)->checker_texture::value(u, v, p);
+    case TEXTURE_NOISE: return static_cast<const noise_texture *>(t)->noise_texture::value(u, v, p);
+    case TEXTURE_MARBLE: return static_cast<const marble_texture *>(t)->marble_texture::value(u, v, p);
+    case TEXTURE_WORLEY: return static_cast<const worley_texture *>(t)->worley_texture::value(u, v, p);
+    default: return t->value(u, v, p);
+    }
+}
+
 #endif
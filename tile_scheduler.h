@@ -0,0 +1,167 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Rectangle of the image [x0, x1) x [y0, y1)
+struct tile
+{
+  int x0, y0;
+  int x1, y1;
+};
+
+/* Splits the image into small tiles and renders them on every hardware thread.
+   Each worker owns a queue seeded with a contiguous run of tiles, so neighbouring
+   tiles stay on the same thread. A worker whose queue runs dry steals from the
+   back of another worker's queue, which keeps every thread busy until the frame
+   is done. Tiles only ever write their own pixels, so the image does not depend
+   on which thread happened to render a tile. */
+class tile_scheduler
+{
+ public:
+  tile_scheduler(int width, int height, int tile_size, int num_threads);
+  ~tile_scheduler();
+
+  // Calls render_tile(const tile&) for every tile and blocks until all are done.
+  // report(double) is called periodically on the calling thread with the fraction completed.
+  template <typename F, typename P>
+    void run(F render_tile, P report);
+
+  int thread_count() const { return num_threads; }
+  const std::vector<tile>& tiles() const { return all_tiles; }
+
+ private:
+  struct worker_queue
+  {
+    std::mutex lock;
+    std::deque<int> tiles;
+    char pad[64];  // keep queues of different workers on separate cache lines
+  };
+
+  bool next_tile(int worker, int& index);
+
+  std::vector<tile> all_tiles;
+  std::vector<worker_queue*> queues;
+  std::atomic<int> tiles_done;
+  int num_threads;
+  // Wakes the reporting thread as soon as the last tile is done
+  std::mutex done_lock;
+  std::condition_variable all_done;
+};
+
+inline int default_thread_count()
+{
+  int n = (int)std::thread::hardware_concurrency();
+  return n > 0 ? n : 4;
+}
+
+// Tiles are ordered top scanline first, matching the order the image is written
+std::vector<tile> split_tiles(int width, int height, int tile_size)
+{
+  std::vector<tile> tiles;
+  for (int y1 = height; y1 > 0; y1 -= tile_size)
+    {
+      for (int x0 = 0; x0 < width; x0 += tile_size)
+	{
+	  tile t;
+	  t.x0 = x0;
+	  t.x1 = std::min(x0 + tile_size, width);
+	  t.y0 = std::max(y1 - tile_size, 0);
+	  t.y1 = y1;
+	  tiles.push_back(t);
+	}
+    }
+  return tiles;
+}
+
+tile_scheduler::tile_scheduler(int width, int height, int tile_size, int threads)
+  : all_tiles(split_tiles(width, height, tile_size)), tiles_done(0), num_threads(threads > 0 ? threads : default_thread_count())
+{
+  int n = (int)all_tiles.size();
+  for (int w = 0; w < num_threads; ++w)
+    {
+      worker_queue *q = new worker_queue;
+      for (int i = w * n / num_threads; i < (w + 1) * n / num_threads; ++i)
+	q->tiles.push_back(i);
+      queues.push_back(q);
+    }
+}
+
+tile_scheduler::~tile_scheduler()
+{
+  for (size_t i = 0; i < queues.size(); ++i)
+    delete queues[i];
+}
+
+bool tile_scheduler::next_tile(int worker, int& index)
+{
+  {
+    worker_queue& own = *queues[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.tiles.empty())
+      {
+	index = own.tiles.front();
+	own.tiles.pop_front();
+	return true;
+      }
+  }
+
+  // Own queue is empty, steal from the far end of the other queues
+  for (int i = 1; i < num_threads; ++i)
+    {
+      worker_queue& victim = *queues[(worker + i) % num_threads];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.tiles.empty())
+	{
+	  index = victim.tiles.back();
+	  victim.tiles.pop_back();
+	  return true;
+	}
+    }
+  return false;
+}
+
+template <typename F, typename P>
+void tile_scheduler::run(F render_tile, P report)
+{
+  int total = (int)all_tiles.size();
+  std::vector<std::thread> workers;
+  for (int w = 0; w < num_threads; ++w)
+    {
+      workers.push_back(std::thread([this, w, total, &render_tile]() {
+	    int index;
+	    while (next_tile(w, index))
+	      {
+		render_tile(all_tiles[index]);
+		if (++tiles_done == total)
+		  {
+		    std::lock_guard<std::mutex> guard(done_lock);
+		    all_done.notify_all();
+		  }
+	      }
+	  }));
+    }
+
+  // Only this thread talks to stdout while the workers render. It reports every
+  // 100ms, but the last tile wakes it at once so short renders are timed right
+  std::unique_lock<std::mutex> guard(done_lock);
+  while (tiles_done.load() < total)
+    {
+      report(double(tiles_done.load()) / total);
+      all_done.wait_for(guard, std::chrono::milliseconds(100), [this, total]() { return tiles_done.load() >= total; });
+    }
+  guard.unlock();
+  report(1.0);
+
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <math.h>
+#include "vec3.h"
+
+/* Affine transform, a 3x3 linear part in the first three columns and a
+   translation in the last, so the bottom row 0 0 0 1 is never stored.
+   Transforms compose like matrices: (a * b) applies b first. */
+class transform
+{
+ public:
+  transform();  // identity
+
+  static transform translate(const vec3& offset);
+  static transform scale(const vec3& factors);
+  // Counter clockwise about axis when looking down it, as in the right handed scenes
+  static transform rotate(const vec3& axis, float degrees);
+
+  transform operator*(const transform& b) const;
+  // Undefined for transforms that flatten space, such as a scale by 0
+  transform inverse() const;
+
+  vec3 point(const vec3& p) const
+  {
+    return vec3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+		m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+		m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+  }
+  // Directions ignore the translation
+  vec3 vector(const vec3& v) const
+  {
+    return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+		m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+		m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+  }
+  // By the transpose of the linear part. Normals move by the inverse transposed,
+  // so the inverse transform moves them with this and stays unit free
+  vec3 transposed_vector(const vec3& v) const
+  {
+    return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+		m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+		m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+  }
+
+  float m[3][4];
+};
+
+transform::transform()
+{
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 4; ++j)
+      m[i][j] = i == j ? 1.0f : 0.0f;
+}
+
+transform transform::translate(const vec3& offset)
+{
+  transform t;
+  for (int i = 0; i < 3; ++i)
+    t.m[i][3] = offset[i];
+  return t;
+}
+
+transform transform::scale(const vec3& factors)
+{
+  transform t;
+  for (int i = 0; i < 3; ++i)
+    t.m[i][i] = factors[i];
+  return t;
+}
+
+// Rodrigues' formula
+transform transform::rotate(const vec3& axis, float degrees)
+{
+  vec3 a = unit_vector(axis);
+  float theta = degrees * float(M_PI) / 180.0f;
+  float c = cosf(theta), s = sinf(theta);
+  transform t;
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      t.m[i][j] = a[i] * a[j] * (1.0f - c) + (i == j ? c : 0.0f);
+  t.m[0][1] -= a.z() * s;  t.m[0][2] += a.y() * s;
+  t.m[1][0] += a.z() * s;  t.m[1][2] -= a.x() * s;
+  t.m[2][0] -= a.y() * s;  t.m[2][1] += a.x() * s;
+  return t;
+}
+
+transform transform::operator*(const transform& b) const
+{
+  transform t;
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 4; ++j)
+      t.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j] + (j == 3 ? m[i][3] : 0.0f);
+  return t;
+}
+
+// Adjugate over determinant for the linear part, then the translation undone by it
+transform transform::inverse() const
+{
+  transform t;
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      {
+	int r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+	t.m[i][j] = m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0];
+      }
+  float det = m[0][0] * t.m[0][0] + m[0][1] * t.m[1][0] + m[0][2] * t.m[2][0];
+  float inv_det = 1.0f / det;
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      t.m[i][j] *= inv_det;
+  for (int i = 0; i < 3; ++i)
+    t.m[i][3] = -(t.m[i][0] * m[0][3] + t.m[i][1] * m[1][3] + t.m[i][2] * m[2][3]);
+  return t;
+}
+
+#endif
@@ -5,11 +5,11 @@
 #include "vec3.h"
 #include "hitable.h"
 
-class triangle : public hitable
+class triangle final : public hitable
 {
  public:
-  triangle() {}
- triangle(vec3 _v0, vec3 _v1, vec3 _v2, material* m) : v0(_v0), v1(_v1), v2(_v2), mat_ptr(m)
+  triangle() : hitable(HITABLE_TRIANGLE) {}
+ triangle(vec3 _v0, vec3 _v1, vec3 _v2, material* m) : hitable(HITABLE_TRIANGLE), v0(_v0), v1(_v1), v2(_v2), mat_ptr(m)
   {
     // Calculate normal, given the 3 vertices
     vec3 v1_v0 = v1 - v0;
@@ -19,6 +19,8 @@ class triangle : public hitable
   };
 
   virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual void hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const;
 
   vec3 v0;
   vec3 v1;
@@ -29,6 +31,7 @@ class triangle : public hitable
 
 bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+  local_stats().tests[PRIM_TRIANGLE]++;
   // if dot(r.direction(), norm) is approximately equal to zero, then ray direction is parallel to plane and will never intersect the plane of the triangle
   if (dot(r.direction(), norm) > 1e-6)
     {
@@ -62,7 +65,9 @@ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	  rec.p = r.point_at_parameter(rec.t);
 
 	  rec.normal = norm;
+	  rec.u = rec.v = 0.0f;
 	  rec.mat_ptr = mat_ptr;
+	  local_stats().hits[PRIM_TRIANGLE]++;
 	  return true;
 	}
     }
@@ -70,4 +75,77 @@ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
   return false;
 }
 
+// Same inside-outside test as hit(), SIMD_WIDTH rays at a time
+void triangle::hit_packet(const ray_packet& rp, float t_min, packet_hits& hits) const
+{
+  local_stats().tests[PRIM_TRIANGLE] += rp.size;
+  const vec3 edge0 = v1 - v0;
+  const vec3 edge1 = v2 - v1;
+  const vec3 edge2 = v0 - v2;
+  const vfloat nx(norm.x()), ny(norm.y()), nz(norm.z());
+  const vfloat tmin(t_min), zero(0.0f), eps(1e-6f);
+
+  for (int k = 0; k < rp.size; k += SIMD_WIDTH)
+    {
+      vfloat dx = vfloat::load(rp.dx + k), dy = vfloat::load(rp.dy + k), dz = vfloat::load(rp.dz + k);
+      vfloat ox = vfloat::load(rp.ox + k), oy = vfloat::load(rp.oy + k), oz = vfloat::load(rp.oz + k);
+      vfloat denominator = dx*nx + dy*ny + dz*nz;
+      vmask valid = denominator > eps;
+      if (!any(valid))
+	continue;
+      vfloat numerator = (vfloat(v0.x()) - ox)*nx + (vfloat(v0.y()) - oy)*ny + (vfloat(v0.z()) - oz)*nz;
+      vfloat t = numerator / denominator;
+      valid = valid & (t < vfloat::load(hits.t + k)) & (t > tmin);
+      if (!any(valid))
+	continue;
+
+      vfloat px = ox + dx*t, py = oy + dy*t, pz = oz + dz*t;
+      const vec3 *verts[3] = { &v0, &v1, &v2 };
+      const vec3 *edges[3] = { &edge0, &edge1, &edge2 };
+      for (int e = 0; e < 3; ++e)
+	{
+	  // dot(norm, cross(edge, p - vert)) > 0
+	  const vec3& ed = *edges[e];
+	  vfloat cx = px - vfloat(verts[e]->x()), cy = py - vfloat(verts[e]->y()), cz = pz - vfloat(verts[e]->z());
+	  vfloat crx = vfloat(ed.y())*cz - vfloat(ed.z())*cy;
+	  vfloat cry = -(vfloat(ed.x())*cz - vfloat(ed.z())*cx);
+	  vfloat crz = vfloat(ed.x())*cy - vfloat(ed.y())*cx;
+	  valid = valid & ((nx*crx + ny*cry + nz*crz) > zero);
+	}
+      int mask = movemask(valid);
+      if (!mask)
+	continue;
+
+      alignas(32) float tt[SIMD_WIDTH];
+      t.store(tt);
+      for (int l = 0; l < SIMD_WIDTH; ++l)
+	{
+	  if (!(mask & (1 << l)))
+	    continue;
+	  int i = k + l;
+	  hit_record& rec = hits.rec[i];
+	  rec.t = tt[l];
+	  rec.p = rp.get(i).point_at_parameter(rec.t);
+	  rec.normal = norm;
+	  rec.u = rec.v = 0.0f;
+	  rec.mat_ptr = mat_ptr;
+	  hits.t[i] = rec.t;
+	  hits.hit[i] = true;
+	  local_stats().hits[PRIM_TRIANGLE]++;
+	}
+    }
+}
+
+bool triangle::bounding_box(float t0, float t1, aabb& box) const
+{
+  box = aabb();
+  box.expand(v0);
+  box.expand(v1);
+  box.expand(v2);
+  // Pad flat boxes so axis aligned triangles still have volume
+  vec3 pad(1e-4f, 1e-4f, 1e-4f);
+  box = aabb(box.min() - pad, box.max() + pad);
+  return true;
+}
+
 #endif
@@ -5,8 +5,6 @@
 #include <stdlib.h>
 #include <iostream>
 
-double drand48(void);
-
 class vec3
 {
  public:
@@ -143,9 +141,21 @@ inline vec3 unit_vector(vec3 v) {
   return v / v.length();
 }
 
-double drand48()
-{
-  return (double)rand()/(RAND_MAX + 1.0);
+inline float luminance(const vec3 &c) {
+  return 0.2126f * c.e[0] + 0.7152f * c.e[1] + 0.0722f * c.e[2];
+}
+
+inline bool is_black(const vec3 &c) {
+  return c.e[0] == 0.0f && c.e[1] == 0.0f && c.e[2] == 0.0f;
+}
+
+// Two unit vectors that form an orthonormal basis with the unit vector n (Duff et al. 2017)
+inline void orthonormal_basis(const vec3 &n, vec3 &t, vec3 &b) {
+  float sign = n.e[2] >= 0.0f ? 1.0f : -1.0f;
+  float a = -1.0f / (sign + n.e[2]);
+  float c = n.e[0] * n.e[1] * a;
+  t = vec3(1.0f + sign * n.e[0] * n.e[0] * a, sign * c, -sign * n.e[0]);
+  b = vec3(c, sign + n.e[1] * n.e[1] * a, -n.e[1]);
 }
 
 #endif
@@ -0,0 +1,432 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "render.h"
+#include "sphere_set.h"
+
+/* Wavefront path tracing. Instead of following one path to its end before
+   starting the next, a tile's samples are traced as waves of up to
+   SETTINGS.wavefront paths, kept in structure of arrays buffers and advanced
+   one bounce at a time. Every bounce is a sequence of passes over the wave:
+   intersection, shading and scattering, the shadow rays the shading asked for,
+   and resolving their results. Before intersecting, rays are sorted by
+   direction octant and then along a Morton curve through their origins, so
+   consecutive rays take similar routes through the bvh. Before shading they
+   are sorted by material, so each material's code and textures stay in cache.
+   This pays off on big scenes, where memory traffic rather than arithmetic
+   limits the path at a time tracer.
+
+   Every path draws from its own random streams (see begin_sample), and the
+   samples of a pixel are added up in order, so the image is bit for bit the
+   one trace() renders without packets. */
+
+// Paths in a wave are addressed with 26 bits in the sort keys
+const int MAX_WAVE_SIZE = 1 << 26;
+
+enum path_state
+  {
+    PATH_MISSED,     // left the scene, finished
+    PATH_ABSORBED,   // ends once its shadow rays are resolved
+    PATH_SCATTERED   // goes on with the scattered ray
+  };
+
+// Paths of one wave, one array per field so that every pass only touches the fields it needs
+struct wave
+{
+    void resize(int n);
+
+    std::vector<ray> rays;
+    std::vector<hit_record> recs;
+    std::vector<char> hit;
+    std::vector<char> state;
+    std::vector<vec3> throughput;
+    std::vector<vec3> result;
+    std::vector<float> scatter_pdf;
+    std::vector<uint64_t> path_key;     // random stream of the path, see begin_sample
+    std::vector<uint64_t> rng_counter;  // numbers the path has drawn in its current bounce
+    std::vector<ray> scattered;
+    std::vector<vec3> attenuation;
+    std::vector<vec3> light;            // light sample waiting on its shadow ray, global mode
+    std::vector<int> blocked;           // shadow rays found blocked. A path without a light sample counts as blocked
+    std::vector<vec3> albedo;           // first hit features, when the denoiser needs them
+    std::vector<vec3> normal;
+    std::vector<float> depth;
+
+    // Shadow rays of the current bounce and the paths they belong to
+    std::vector<ray> shadow_rays;
+    std::vector<float> shadow_t_max;
+    std::vector<int> shadow_path;
+
+    std::vector<int> active;            // live paths, in the order the next pass visits them
+    std::vector<uint64_t> keys;
+    std::vector<int> sorted;
+};
+
+void wave::resize(int n)
+{
+    rays.resize(n);
+    recs.resize(n);
+    hit.resize(n);
+    state.resize(n);
+    throughput.resize(n);
+    result.resize(n);
+    scatter_pdf.resize(n);
+    path_key.resize(n);
+    rng_counter.resize(n);
+    scattered.resize(n);
+    attenuation.resize(n);
+    light.resize(n);
+    blocked.resize(n);
+    albedo.resize(n);
+    normal.resize(n);
+    depth.resize(n);
+}
+
+// Every render thread reuses its wave from tile to tile
+thread_local wave THREAD_WAVE;
+
+// Orders w.active by key(path), keeping the current order among equal keys. Keys must fit in 38 bits
+template <typename K>
+void sortActive(wave& w, K key)
+{
+    const int n = (int)w.active.size();
+    w.keys.resize(n);
+    for (int i = 0; i < n; ++i)
+        w.keys[i] = (uint64_t(key(w.active[i])) << 26) | uint64_t(i);
+    std::sort(w.keys.begin(), w.keys.end());
+    w.sorted.resize(n);
+    for (int i = 0; i < n; ++i)
+        w.sorted[i] = w.active[w.keys[i] & (MAX_WAVE_SIZE - 1)];
+    w.active.swap(w.sorted);
+}
+
+// Direction octant, then the origin along a Morton curve through the box of all live origins
+void sortByRay(wave& w)
+{
+    aabb bounds;
+    for (size_t i = 0; i < w.active.size(); ++i)
+        bounds.expand(w.rays[w.active[i]].origin());
+    const vec3 lo = bounds.min();
+    const vec3 extent = bounds.max() - lo;
+    vec3 scale;
+    for (int a = 0; a < 3; ++a)
+        scale[a] = extent[a] > 0.0f ? 1023.0f / extent[a] : 0.0f;
+
+    sortActive(w, [&](int p) {
+                      const vec3& o = w.rays[p].origin();
+                      const vec3& d = w.rays[p].direction();
+                      uint32_t octant = (d.x() < 0.0f ? 1 : 0) | (d.y() < 0.0f ? 2 : 0) | (d.z() < 0.0f ? 4 : 0);
+                      uint32_t code = 0;
+                      for (int a = 0; a < 3; ++a)
+                          code |= morton_spread(uint32_t((o[a] - lo[a])*scale[a])) << a;
+                      return (uint64_t(octant) << 30) | code;
+                  });
+}
+
+// Material kind, then the material itself. Paths that missed go last
+void sortByMaterial(wave& w)
+{
+    sortActive(w, [&](int p) {
+                      if (!w.hit[p])
+                          return (uint64_t(1) << 38) - 1;
+                      const material *m = w.recs[p].mat_ptr;
+                      return (uint64_t(m->kind) << 30) | ((uintptr_t(m) >> 4) & 0x3fffffff);
+                  });
+}
+
+// Running sums of one pixel while the wavefront tracer adds its samples
+struct pixel_sum
+{
+    int x, y;
+    int n, resumed;
+    vec3 col, albedo, normal;
+    float depth;
+    double mean, m2;
+    bool done;
+};
+
+// One camera sample of the round
+struct pixel_task
+{
+    int slot;    // index into the tile's pixel_sums
+    int sample;
+};
+
+/* Traces the camera samples of tasks as one wave, leaving every sample's
+   radiance in w.result and its first hit features in w.albedo, w.normal and
+   w.depth. Mirrors radiance() stage by stage. */
+template <lighting_mode MODE>
+void traceWave(wave& w, const pixel_task *tasks, int count, const std::vector<pixel_sum>& pixels, const scene& sc, camera& cam)
+{
+    const hitable *world = sc.world;
+    const int width = SETTINGS.width;
+    const int height = SETTINGS.height;
+    const bool features = SETTINGS.denoise > 0;
+    const bool sampleLights = MODE == LIGHT_GLOBAL && !sc.lights.empty();
+
+    w.resize(count);
+    w.active.clear();
+    for (int k = 0; k < count; ++k)
+    {
+        const pixel_sum& ps = pixels[tasks[k].slot];
+        begin_sample(ps.y*width + ps.x, tasks[k].sample);
+        local_stats().primary_rays++;
+        float u = float(ps.x + random_float()) / float(width);
+        float v = float(ps.y + random_float()) / float(height);
+        w.rays[k] = cam.get_ray(u, v);
+        w.path_key[k] = THREAD_PATH_KEY;
+        w.throughput[k] = vec3(1.0f, 1.0f, 1.0f);
+        w.result[k] = vec3(0.0f, 0.0f, 0.0f);
+        w.scatter_pdf[k] = 0.0f;
+        w.albedo[k] = w.normal[k] = vec3(0.0f, 0.0f, 0.0f);
+        w.depth[k] = 0.0f;
+        w.active.push_back(k);
+    }
+
+    for (int depth = 0; !w.active.empty(); ++depth)
+    {
+        sortByRay(w);
+        for (size_t i = 0; i < w.active.size(); ++i)
+        {
+            const int p = w.active[i];
+            if (depth > 0)
+                local_stats().secondary_rays++;
+            w.hit[p] = world->hit(w.rays[p], 0.001f, FLT_MAX, w.recs[p]);
+            if (depth == 0 && features)
+                addFeatures(w.rays[p], w.hit[p], w.recs[p], w.albedo[p], w.normal[p], w.depth[p]);
+        }
+
+        // Shading draws every random number of the bounce but the roulette's, and queues the shadow rays
+        sortByMaterial(w);
+        w.shadow_rays.clear();
+        w.shadow_t_max.clear();
+        w.shadow_path.clear();
+        for (size_t i = 0; i < w.active.size(); ++i)
+        {
+            const int p = w.active[i];
+            const ray& r = w.rays[p];
+            const hit_record& rec = w.recs[p];
+            THREAD_PATH_KEY = w.path_key[p];
+            begin_bounce(depth);
+            if (!w.hit[p])
+            {
+                count_path_depth(depth);
+                if (sc.sky)
+                    w.result[p] = w.result[p] + w.throughput[p]*sky(r);
+                w.state[p] = PATH_MISSED;
+                continue;
+            }
+
+            vec3 emitted = material_emitted(rec.mat_ptr, r, rec);
+            if (!is_black(emitted))
+            {
+                float weight = 1.0f;
+                if (sampleLights && w.scatter_pdf[p] > 0.0f)
+                    weight = power_heuristic(w.scatter_pdf[p], lightPdf(sc, r.origin(), r.direction()));
+                w.result[p] += w.throughput[p]*emitted*weight;
+            }
+            w.blocked[p] = MODE == LIGHT_GLOBAL ? 1 : 0;
+            if (sampleLights && material_is_diffuse(rec.mat_ptr) && depth < SETTINGS.depth)
+            {
+                ray toLight;
+                float t_max;
+                if (sampleLight(sc, r, rec, toLight, t_max, w.light[p]))
+                {
+                    w.blocked[p] = 0;
+                    w.shadow_rays.push_back(toLight);
+                    w.shadow_t_max.push_back(t_max);
+                    w.shadow_path.push_back(p);
+                }
+            }
+            if (MODE == LIGHT_SHADOWS)
+            {
+                for (int s = 0; s < SETTINGS.shadow_depth; ++s)
+                {
+                    w.shadow_rays.push_back(shadowRay(sc, rec, r.time()));
+                    w.shadow_t_max.push_back(FLT_MAX);
+                    w.shadow_path.push_back(p);
+                }
+            }
+            bool scattered = depth < SETTINGS.depth && material_scatter(rec.mat_ptr, r, rec, w.attenuation[p], w.scattered[p], sc.light_pos);
+            w.state[p] = scattered ? PATH_SCATTERED : PATH_ABSORBED;
+            w.rng_counter[p] = THREAD_RNG.counter;
+        }
+
+        for (size_t i = 0; i < w.shadow_rays.size(); ++i)
+        {
+            if (MODE == LIGHT_GLOBAL)
+            {
+                local_stats().shadow_rays++;
+                if (world->occluded(w.shadow_rays[i], 0.001f, w.shadow_t_max[i]))
+                    w.blocked[w.shadow_path[i]] = 1;
+            }
+            else if (shadowBlocked(sc, w.shadow_rays[i]))
+                w.blocked[w.shadow_path[i]]++;
+        }
+
+        // Finish the bounce and keep the paths that go on
+        int live = 0;
+        for (size_t i = 0; i < w.active.size(); ++i)
+        {
+            const int p = w.active[i];
+            if (w.state[p] == PATH_MISSED)
+                continue;
+            const hit_record& rec = w.recs[p];
+            if (MODE == LIGHT_GLOBAL && w.blocked[p] == 0)
+                w.result[p] += w.throughput[p]*w.light[p];
+            float spec = 0.0f;
+            vec3 shade(1.0f, 1.0f, 1.0f);
+            if (MODE == LIGHT_SHADOWS)
+                shade = shadowShade(sc, rec, w.blocked[p], spec);
+            if (w.state[p] == PATH_ABSORBED)
+            {
+                count_path_depth(depth);
+                continue;
+            }
+            if (MODE == LIGHT_SHADOWS)
+            {
+                w.result[p] += w.throughput[p]*spec;
+                w.throughput[p] *= shade;
+            }
+            w.throughput[p] *= w.attenuation[p];
+            w.scatter_pdf[p] = material_is_diffuse(rec.mat_ptr) ? material_pdf(rec.mat_ptr, w.rays[p], rec, w.scattered[p].direction()) : 0.0f;
+
+            if (SETTINGS.roulette > 0 && depth + 1 >= SETTINGS.roulette)
+            {
+                THREAD_PATH_KEY = w.path_key[p];
+                begin_bounce(depth);
+                THREAD_RNG.counter = w.rng_counter[p];
+                const vec3& t = w.throughput[p];
+                float survive = std::min(std::max(t.x(), std::max(t.y(), t.z())), 0.95f);
+                if (!(random_float() < survive))
+                {
+                    count_path_depth(depth);
+                    continue;
+                }
+                w.throughput[p] /= survive;
+            }
+            w.rays[p] = w.scattered[p];
+            w.active[live++] = p;
+        }
+        w.active.resize(live);
+    }
+}
+
+// Samples a pixel takes before adaptive sampling next checks it, the same points trace() checks at
+inline int roundEnd(int n, int samples, int min_samples, bool adaptive)
+{
+    if (!adaptive)
+        return samples;
+    int next = (n / ADAPTIVE_BATCH + 1)*ADAPTIVE_BATCH;
+    if (next < min_samples)
+        next = (min_samples + ADAPTIVE_BATCH - 1) / ADAPTIVE_BATCH*ADAPTIVE_BATCH;
+    return std::min(next, samples);
+}
+
+// Same result as trace(), with the samples of the tile traced in waves. Adaptive sampling runs in rounds that end where trace() checks for convergence
+template <lighting_mode MODE>
+void traceWavefront(int minX, int maxX, int minY, int maxY, const scene& sc, camera& cam)
+{
+    const int samples = SETTINGS.samples;
+    const bool adaptive = SETTINGS.adaptive();
+    const int min_samples = adaptive ? std::max(2, std::min(SETTINGS.min_samples, samples)) : samples;
+    const bool features = SETTINGS.denoise > 0;
+    const int wave_size = std::min(SETTINGS.wavefront, MAX_WAVE_SIZE);
+
+    std::vector<pixel_sum> pixels;
+    for (int j = maxY - 1; j >= minY; --j)
+    {
+        for (int i = minX; i < maxX; ++i)
+        {
+            pixel_sum ps;
+            ps.x = i;
+            ps.y = j;
+            ps.n = ps.resumed = CANVAS.samples_at(i, j);
+            ps.col = CANVAS.at(i, j)*float(ps.n);
+            ps.albedo = CANVAS.albedo_at(i, j)*float(ps.n);
+            ps.normal = CANVAS.normal_at(i, j)*float(ps.n);
+            ps.depth = CANVAS.depth_at(i, j)*float(ps.n);
+            ps.mean = luminance(CANVAS.at(i, j));
+            ps.m2 = CANVAS.m2_at(i, j);
+            ps.done = adaptive && ps.n >= min_samples && converged(ps.mean, ps.m2, ps.n, SETTINGS.threshold);
+            pixels.push_back(ps);
+        }
+    }
+
+    wave& w = THREAD_WAVE;
+    std::vector<pixel_task> tasks;
+    for (;;)
+    {
+        tasks.clear();
+        for (size_t s = 0; s < pixels.size(); ++s)
+        {
+            const pixel_sum& ps = pixels[s];
+            if (ps.done)
+                continue;
+            int end = roundEnd(ps.n, samples, min_samples, adaptive);
+            for (int n = ps.n; n < end; ++n)
+            {
+                pixel_task t = { (int)s, n };
+                tasks.push_back(t);
+            }
+        }
+        if (tasks.empty())
+            break;
+
+        for (size_t start = 0; start < tasks.size(); start += wave_size)
+        {
+            int count = (int)std::min(tasks.size() - start, (size_t)wave_size);
+            traceWave<MODE>(w, &tasks[start], count, pixels, sc, cam);
+            for (int k = 0; k < count; ++k)
+            {
+                pixel_sum& ps = pixels[tasks[start + k].slot];
+                if (features)
+                {
+                    ps.albedo += w.albedo[k];
+                    ps.normal += w.normal[k];
+                    ps.depth += w.depth[k];
+                }
+                ps.col += w.result[k];
+                ps.n++;
+                if (adaptive || features)
+                {
+                    double l = luminance(w.result[k]);
+                    double delta = l - ps.mean;
+                    ps.mean += delta / ps.n;
+                    ps.m2 += delta * (l - ps.mean);
+                }
+            }
+        }
+
+        for (size_t s = 0; s < pixels.size(); ++s)
+        {
+            pixel_sum& ps = pixels[s];
+            if (ps.n >= samples || (adaptive && ps.n >= min_samples && ps.n % ADAPTIVE_BATCH == 0 && converged(ps.mean, ps.m2, ps.n, SETTINGS.threshold)))
+                ps.done = true;
+        }
+    }
+
+    for (size_t s = 0; s < pixels.size(); ++s)
+    {
+        pixel_sum& ps = pixels[s];
+        if (ps.n == ps.resumed)
+            continue;
+        ps.col /= float(ps.n);
+        putPixel(ps.x, ps.y, ps.col, ps.n, float(ps.m2), ps.albedo/float(ps.n), ps.normal/float(ps.n), ps.depth/float(ps.n));
+    }
+}
+
+// Traces a tile with the integrator picked on the command line
+template <lighting_mode MODE>
+void traceTile(int minX, int maxX, int minY, int maxY, const scene& sc, camera& cam)
+{
+    if (SETTINGS.wavefront > 0)
+        traceWavefront<MODE>(minX, maxX, minY, maxY, sc, cam);
+    else
+        trace<MODE>(minX, maxX, minY, maxY, sc, cam);
+}
+
+#endif
@@ -1,42 +1,141 @@
 #ifndef WORLEYH
 #define WORLEYH
 
+#include <math.h>
+#include <stdint.h>
+#include <cfloat>
+#include <algorithm>
 #include "vec3.h"
+#include "random.h"
 
-// Worley noise
+/* Worley (cellular) noise. Space is cut into unit cubes, each holding a
+   Poisson distributed number of feature points placed by a generator hashed
+   from the seed and the cube, so the points never have to be stored and every
+   process agrees on them. The noise is the distance to the closest (F1) and
+   second closest (F2) feature point, found among the 27 cubes around the point
+   (under the Manhattan metric F2 very rarely lies further out, and is then a
+   little too large). Neighbouring shading points search the
+   same 27 cubes, so every thread keeps the points of the cubes it visited last
+   in a small cache. */
 
-class worley 
+enum worley_metric
+  {
+    WORLEY_EUCLIDEAN,
+    WORLEY_MANHATTAN,
+    WORLEY_CHEBYSHEV
+  };
+
+const int WORLEY_MAX_POINTS = 8;
+const float WORLEY_MEAN_POINTS = 3.0f;
+const int WORLEY_CACHE_SIZE = 128;
+
+// Feature points of one cube
+struct worley_cell
+{
+  uint64_t seed;
+  int i, j, k;
+  int count;  // at least 1, 0 marks an empty cache slot
+  float x[WORLEY_MAX_POINTS], y[WORLEY_MAX_POINTS], z[WORLEY_MAX_POINTS];
+};
+
+// Direct mapped by cube, shared by every worley of the thread since the seed is part of the key
+thread_local worley_cell WORLEY_CACHE[WORLEY_CACHE_SIZE];
+
+class worley
 {
  public:
+  explicit worley(uint64_t s = 0) : seed(s) {}
 
-  vec3 CellNoiseFunc(const vec3 &input, const int seed)
-  {
-    int lastRandom, numberFeaturePoints;
-    vec3 randomDiff, featurePoint;
-    int cubeX, cubeY, cubeZ;
-    
-  
-    // 1. Determine which cube the evaluation point is in
+  // Distances from p to the closest and second closest feature point
+  void distances(const vec3& p, worley_metric metric, float& f1, float& f2) const;
+  // Feature points of cube i j k, regenerated only if the thread has not cached them
+  const worley_cell& cell(int i, int j, int k) const;
 
-    // 2. Generate a RNG for the cube
+  uint64_t seed;
 
-    // 3. Determine how many feature points are in cube using Poisson distribution
-  
-  
+ private:
+  void generate(int i, int j, int k, worley_cell& c) const;
+};
 
-    // 4. Randomly place the feature points in the cube
+void worley::generate(int i, int j, int k, worley_cell& c) const
+{
+  rng gen(seed, ((uint64_t)(uint32_t)i << 32) | (uint32_t)j, (uint32_t)k);
 
-    // 5. Fine the feature point closes to the evaluation point 
+  // Poisson count by multiplying uniforms until they drop below e^-mean. At
+  // least one point per cube keeps the closest point within the 27 cubes searched
+  const float limit = expf(-WORLEY_MEAN_POINTS);
+  int n = 0;
+  for (float product = gen.next_float(); product > limit && n < WORLEY_MAX_POINTS; product *= gen.next_float())
+    n++;
+  c.count = std::max(n, 1);
 
-    // 6. Check neighboring cubes to ensure that there are no closer evaluation points
-  
-  }
+  for (int m = 0; m < c.count; ++m)
+    {
+      c.x[m] = i + gen.next_float();
+      c.y[m] = j + gen.next_float();
+      c.z[m] = k + gen.next_float();
+    }
+  c.seed = seed;
+  c.i = i;
+  c.j = j;
+  c.k = k;
+}
 
- private:
-  
+const worley_cell& worley::cell(int i, int j, int k) const
+{
+  uint32_t h = (uint32_t)i * 73856093u ^ (uint32_t)j * 19349663u ^ (uint32_t)k * 83492791u;
+  worley_cell& c = WORLEY_CACHE[h % WORLEY_CACHE_SIZE];
+  if (c.count == 0 || c.i != i || c.j != j || c.k != k || c.seed != seed)
+    generate(i, j, k, c);
+  return c;
+}
 
+// Metrics are compared before the final root, Euclidean distances stay squared until the end
+inline float worley_distance(float dx, float dy, float dz, worley_metric metric)
+{
+  switch (metric)
+    {
+    case WORLEY_MANHATTAN: return fabsf(dx) + fabsf(dy) + fabsf(dz);
+    case WORLEY_CHEBYSHEV: return std::max(fabsf(dx), std::max(fabsf(dy), fabsf(dz)));
+    default: return dx * dx + dy * dy + dz * dz;
+    }
+}
+
+void worley::distances(const vec3& p, worley_metric metric, float& f1, float& f2) const
+{
+  // The cube p is in is searched first, it usually holds the closest point
+  int ci = (int)floorf(p.x()), cj = (int)floorf(p.y()), ck = (int)floorf(p.z());
+  f1 = f2 = FLT_MAX;
+  for (int n = 0; n < 27; ++n)
+    {
+      int di = (n + 13) % 27 % 3 - 1, dj = (n + 13) % 27 / 3 % 3 - 1, dk = (n + 13) % 27 / 9 - 1;
+      int i = ci + di, j = cj + dj, k = ck + dk;
 
+      // A neighbour can only matter if its nearest face is closer than the current F2
+      float bx = di < 0 ? p.x() - ci : di > 0 ? ci + 1 - p.x() : 0.0f;
+      float by = dj < 0 ? p.y() - cj : dj > 0 ? cj + 1 - p.y() : 0.0f;
+      float bz = dk < 0 ? p.z() - ck : dk > 0 ? ck + 1 - p.z() : 0.0f;
+      if (worley_distance(bx, by, bz, metric) >= f2)
+	continue;
 
-};
+      const worley_cell& c = cell(i, j, k);
+      for (int m = 0; m < c.count; ++m)
+	{
+	  float d = worley_distance(c.x[m] - p.x(), c.y[m] - p.y(), c.z[m] - p.z(), metric);
+	  if (d < f1)
+	    {
+	      f2 = f1;
+	      f1 = d;
+	    }
+	  else if (d < f2)
+	    f2 = d;
+	}
+    }
+  if (metric == WORLEY_EUCLIDEAN)
+    {
+      f1 = sqrtf(f1);
+      f2 = sqrtf(f2);
+    }
+}
 
 #endif